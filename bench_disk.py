@@ -0,0 +1,78 @@
+import os
+import re
+import subprocess
+import sys
+import logging
+
+# 配置日志记录
+logging.basicConfig(level=logging.INFO, format='%(asctime)s - %(levelname)s - %(message)s')
+
+# 在模拟的机械硬盘、SATA 固态硬盘和 NVMe 固态硬盘上运行排序程序，比较不同内存预算（决定归并段数量和
+# 归并路数）和排序引擎的耗时。输入和临时文件放在同一块模拟磁盘上，结果文件不经过模拟磁盘。
+# 需要在包含 test_files/names.txt 的目录中运行（可以先用 test.py 生成），例如：
+#   python3 bench_disk.py ./sorter
+
+PROFILES = ["hdd", "sata", "nvme"]  # 模拟的磁盘类型
+MEMORY_BUDGETS = ["256K", "4M", "64M"]  # 内存预算，越小归并段越多
+ENGINES = ["merge", "bucket"]  # 排序引擎
+INPUT_DIR = "test_files"
+TEMP_DIR = "temp_sort"
+
+DISK_PATTERN = re.compile(r"模拟磁盘 (\S+)（(\S+)）: 读 (\d+) 次 (\d+) 字节，写 (\d+) 次 (\d+) 字节，寻道 (\d+) 次，"
+                          r"平均并发请求 ([\d.e+-]+)，平均阻塞线程 ([\d.e+-]+)")
+ELAPSED_PATTERN = re.compile(r"排序耗时 ([\d.e+-]+) 秒")
+
+
+def run_sorter(sorter, profile, memory, engine):
+    """运行一次排序，返回耗时和各模拟磁盘的统计"""
+    command = [sorter, "--memory", memory, "--engine", engine,
+               "--disk-profile", f"{TEMP_DIR}={profile}", "--disk-profile", f"{INPUT_DIR}={profile}"]
+    result = subprocess.run(command, capture_output=True, text=True)
+    if result.returncode != 0:
+        raise RuntimeError(f"{' '.join(command)} 失败: {result.stderr.strip()}")
+    elapsed = ELAPSED_PATTERN.search(result.stdout)
+    disks = {}
+    for match in DISK_PATTERN.finditer(result.stdout):
+        disks[os.path.basename(match.group(1))] = {
+            "ops": int(match.group(3)) + int(match.group(5)),
+            "bytes": int(match.group(4)) + int(match.group(6)),
+            "seeks": int(match.group(7)),
+            "concurrency": float(match.group(8)),
+            "blocked": float(match.group(9)),
+        }
+    if not elapsed or not disks:
+        raise RuntimeError(f"无法解析排序程序的输出: {result.stdout.strip()}")
+    return float(elapsed.group(1)), disks
+
+
+def main():
+    if len(sys.argv) != 2:
+        print("用法: python3 bench_disk.py 排序程序路径")
+        sys.exit(1)
+    sorter = sys.argv[1]
+    if not os.path.exists(os.path.join(INPUT_DIR, "names.txt")):
+        logging.error(f"找不到 {INPUT_DIR}/names.txt，请先运行 test.py 生成测试文件")
+        sys.exit(1)
+
+    rows = []
+    for profile in PROFILES:
+        for memory in MEMORY_BUDGETS:
+            for engine in ENGINES:
+                logging.info(f"磁盘 {profile}，内存预算 {memory}，引擎 {engine}")
+                try:
+                    elapsed, disks = run_sorter(sorter, profile, memory, engine)
+                except RuntimeError as e:
+                    logging.error(e)
+                    continue
+                temp = disks.get(TEMP_DIR, {"ops": 0, "bytes": 0, "seeks": 0, "concurrency": 0, "blocked": 0})
+                rows.append((profile, memory, engine, elapsed, temp))
+
+    # 中文字符占两列，表头的宽度比数据少算汉字的个数
+    print(f"{'磁盘':<6}{'内存':>6}{'引擎':>8}{'耗时(秒)':>10}{'临时请求':>8}{'临时MB':>9}{'寻道':>8}{'并发请求':>9}{'阻塞线程':>9}")
+    for profile, memory, engine, elapsed, temp in rows:
+        print(f"{profile:<8}{memory:>8}{engine:>10}{elapsed:>12.3f}{temp['ops']:>12}{temp['bytes'] / 2**20:>11.1f}"
+              f"{temp['seeks']:>10}{temp['concurrency']:>13.2f}{temp['blocked']:>13.2f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "block_sort.h"
+
+// 块内排序的基准测试：对 16KB（排序程序的 MEMORY_LIMIT）到 --max-size 的随机数据块，
+// 比较普通内存上的 std::sort、大页内存上的 std::sort 和缓存分层排序的耗时，
+// 并用 perf_event_open 统计末级缓存和数据 TLB 的读缺失次数（没有权限时显示 "-"）。
+//   bench_sort [--max-size 1G] [--min-size 16K] [--repeat 3] [--seed 1]
+
+// 一个硬件缓存事件计数器，打开失败时 Valid() 为 false
+class CacheCounter {
+public:
+    CacheCounter(uint64_t cache, uint64_t result = PERF_COUNT_HW_CACHE_RESULT_MISS) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    CacheCounter(const CacheCounter&) = delete;
+    CacheCounter& operator=(const CacheCounter&) = delete;
+
+    ~CacheCounter() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool Valid() const { return fd_ >= 0; }
+
+    void Start() {
+        if (fd_ >= 0) {
+            ::ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    uint64_t Stop() {
+        uint64_t count = 0;
+        if (fd_ >= 0) {
+            ::ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (::read(fd_, &count, sizeof(count)) != static_cast<ssize_t>(sizeof(count))) {
+                count = 0;
+            }
+        }
+        return count;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+struct Measurement {
+    double seconds = 0;
+    uint64_t llc_misses = 0;
+    uint64_t tlb_misses = 0;
+};
+
+// 解析带 K/M/G 后缀的字节数
+size_t ParseSize(const std::string& text) {
+    size_t pos = 0;
+    size_t value = std::stoull(text, &pos);
+    if (pos < text.size()) {
+        char unit = static_cast<char>(std::toupper(static_cast<unsigned char>(text[pos])));
+        value <<= unit == 'K' ? 10 : unit == 'M' ? 20 : unit == 'G' ? 30 : 0;
+    }
+    return value;
+}
+
+std::string FormatSize(size_t bytes) {
+    if (bytes >= (1ULL << 30)) {
+        return std::to_string(bytes >> 30) + "G";
+    }
+    if (bytes >= (1ULL << 20)) {
+        return std::to_string(bytes >> 20) + "M";
+    }
+    return std::to_string(bytes >> 10) + "K";
+}
+
+// 重复 repeat 次取耗时最短的一次；prepare 不计入耗时和计数
+template <typename Prepare, typename Run>
+Measurement Measure(int repeat, CacheCounter& llc, CacheCounter& tlb, Prepare prepare, Run run) {
+    // 先不计时地运行一次，让 CPU 升到工作频率，并让内存页都已经映射
+    prepare();
+    run();
+    Measurement best;
+    for (int r = 0; r < repeat; ++r) {
+        prepare();
+        llc.Start();
+        tlb.Start();
+        auto start = std::chrono::steady_clock::now();
+        run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t tlb_misses = tlb.Stop();
+        uint64_t llc_misses = llc.Stop();
+        if (r == 0 || seconds < best.seconds) {
+            best = {seconds, llc_misses, tlb_misses};
+        }
+    }
+    return best;
+}
+
+void PrintRow(const std::string& size, const std::string& method, size_t keys, const Measurement& m,
+              const CacheCounter& llc, const CacheCounter& tlb) {
+    std::cout << std::left << std::setw(8) << size << std::setw(22) << method << std::right << std::fixed
+              << std::setprecision(3) << std::setw(12) << m.seconds * 1000 << std::setprecision(2) << std::setw(10)
+              << m.seconds * 1e9 / keys;
+    if (llc.Valid()) {
+        std::cout << std::setw(14) << m.llc_misses;
+    } else {
+        std::cout << std::setw(14) << "-";
+    }
+    if (tlb.Valid()) {
+        std::cout << std::setw(14) << m.tlb_misses;
+    } else {
+        std::cout << std::setw(14) << "-";
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t min_size = 16 << 10;
+    size_t max_size = 1 << 30;
+    int repeat = 3;
+    uint64_t seed = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--max-size" && i + 1 < argc) {
+            max_size = ParseSize(argv[++i]);
+        } else if (arg == "--min-size" && i + 1 < argc) {
+            min_size = ParseSize(argv[++i]);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::stoull(argv[++i]);
+        } else {
+            std::cerr << "无效的参数: " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (min_size < sizeof(int64_t) || min_size > max_size) {
+        std::cerr << "数据块大小范围无效" << std::endl;
+        return 1;
+    }
+
+    CacheCounter llc(PERF_COUNT_HW_CACHE_LL);
+    CacheCounter tlb(PERF_COUNT_HW_CACHE_DTLB);
+    std::cout << "L2 缓存 " << FormatSize(DetectL2CacheSize()) << "，分块至少 " << CacheChunkKeys() << " 个键，最多归并 "
+              << MAX_MERGE_CHUNKS << " 个分块"
+#if defined(__AVX2__)
+              << "，排序网络使用 AVX2"
+#endif
+              << std::endl;
+    if (!llc.Valid() || !tlb.Valid()) {
+        std::cout << "无法打开硬件缓存计数器（需要 perf_event_paranoid <= 2 或 CAP_PERFMON），缺失次数显示为 -"
+                  << std::endl;
+    }
+    std::cout << std::left << std::setw(8) << "大小" << std::setw(22) << "方法" << std::right << std::setw(12)
+              << "耗时(ms)" << std::setw(10) << "ns/键" << std::setw(14) << "LLC读缺失" << std::setw(14)
+              << "dTLB读缺失" << std::endl;
+
+    std::mt19937_64 random(seed);
+    for (size_t bytes = min_size; bytes <= max_size; bytes *= 2) {
+        size_t keys = bytes / sizeof(int64_t);
+        KeyBlock original(keys);
+        for (auto& key : original) {
+            key = static_cast<int64_t>(random());
+        }
+        std::string size = FormatSize(bytes);
+        // 小数据块一次只有几十微秒，多重复一些次数才能得到稳定的最短时间
+        int runs = static_cast<int>(std::max<size_t>(repeat, std::min<size_t>((64 << 20) / bytes, 1000)));
+
+        std::vector<int64_t> plain(keys);
+        Measurement m = Measure(runs, llc, tlb, [&]() { std::copy(original.begin(), original.end(), plain.begin()); },
+                                [&]() { std::sort(plain.begin(), plain.end()); });
+        PrintRow(size, "std::sort", keys, m, llc, tlb);
+        std::vector<int64_t> expected;
+        expected.swap(plain);
+
+        KeyBlock huge(keys);
+        m = Measure(runs, llc, tlb, [&]() { std::copy(original.begin(), original.end(), huge.begin()); },
+                    [&]() { std::sort(huge.begin(), huge.end()); });
+        PrintRow(size, "std::sort+大页", keys, m, llc, tlb);
+
+        // 分块排序后用败者树归并到另一块内存，与排序程序逐个取出写入归并段相同
+        size_t chunk_keys = ChunkKeysFor(keys);
+        std::vector<int64_t> scratch(chunk_keys);
+        KeyBlock merged(keys);
+        m = Measure(runs, llc, tlb, [&]() { std::copy(original.begin(), original.end(), huge.begin()); },
+                    [&]() {
+                        SortChunks<false>(huge.data(), keys, scratch.data(), chunk_keys);
+                        ChunkMerger<false> merger(huge.data(), keys, chunk_keys);
+                        int64_t* out = merged.data();
+                        while (merger.Next(*out)) {
+                            ++out;
+                        }
+                    });
+        PrintRow(size, "分块排序+败者树+大页", keys, m, llc, tlb);
+        if (!std::equal(expected.begin(), expected.end(), merged.begin())) {
+            std::cerr << size << ": 分块排序的结果与 std::sort 不一致" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
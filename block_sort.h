@@ -0,0 +1,310 @@
+#ifndef BLOCK_SORT_H
+#define BLOCK_SORT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// 缓存分层的块内排序库。
+// 数据块远大于缓存时，对整块 std::sort 的每一层划分都要把整个块过一遍缓存和 TLB。
+// 这里先把数据块切成 L2 大小的分块：每 8 个键用排序网络排好，再在分块内逐层两两归并，
+// 分块和归并缓存始终留在 L2 中；最后用败者树在缓存中多路归并各个分块，按顺序逐个取出键。
+// 败者树每取一个键要沿一条路径比较 log2(分块数) 次，这些比较前后依赖，
+// 所以块很大时把分块放大，分块数不超过 MAX_MERGE_CHUNKS；此时分块内的归并是顺序访问，预取能跟上。
+// 只有几千个键的块直接 std::sort 更快（见 bench_sort）。
+
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+const size_t DEFAULT_L2_CACHE_SIZE = 256 << 10;
+const size_t SORT_TILE_KEYS = 8; // 排序网络一次排好的键数
+const size_t MAX_MERGE_CHUNKS = 16; // 败者树归并的最多分块数
+const size_t MIN_CHUNK_SORT_KEYS = 4096; // 少于这么多键的块直接 std::sort
+
+// L2 缓存的字节数，读不到时使用 DEFAULT_L2_CACHE_SIZE
+inline size_t DetectL2CacheSize() {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long configured = ::sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (configured > 0) {
+        return static_cast<size_t>(configured);
+    }
+#endif
+    // sysfs 中的大小形如 "1024K"
+    std::ifstream input("/sys/devices/system/cpu/cpu0/cache/index2/size");
+    size_t size = 0;
+    std::string unit;
+    if (input >> size) {
+        input >> unit;
+        if (unit == "K") {
+            size <<= 10;
+        } else if (unit == "M") {
+            size <<= 20;
+        }
+    }
+    return size > 0 ? size : DEFAULT_L2_CACHE_SIZE;
+}
+
+// 分块的键数：分块和同样大小的归并缓存合起来占满 L2，取 SORT_TILE_KEYS 的整数倍
+inline size_t CacheChunkKeys() {
+    static const size_t keys =
+        std::max(DetectL2CacheSize() / 2 / sizeof(int64_t) / SORT_TILE_KEYS * SORT_TILE_KEYS, SORT_TILE_KEYS);
+    return keys;
+}
+
+// 排序 count 个键时的分块键数
+inline size_t ChunkKeysFor(size_t count) {
+    size_t chunk = std::max(CacheChunkKeys(), (count + MAX_MERGE_CHUNKS - 1) / MAX_MERGE_CHUNKS);
+    chunk = (chunk + SORT_TILE_KEYS - 1) / SORT_TILE_KEYS * SORT_TILE_KEYS;
+    return std::min(chunk, count);
+}
+
+// 大块内存按 2MB 对齐分配并建议内核使用透明大页，减少随机访问整块数据时的 TLB 缺失；
+// 小块内存照常分配
+template <typename T>
+struct HugePageAllocator {
+    using value_type = T;
+
+    HugePageAllocator() = default;
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        size_t bytes = count * sizeof(T);
+        void* memory = nullptr;
+        if (bytes >= HUGE_PAGE_SIZE) {
+            if (::posix_memalign(&memory, HUGE_PAGE_SIZE, bytes) != 0) {
+                throw std::bad_alloc();
+            }
+            ::madvise(memory, bytes, MADV_HUGEPAGE);
+        } else if ((memory = std::malloc(bytes)) == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(memory);
+    }
+
+    void deallocate(T* memory, size_t) { std::free(memory); }
+
+    template <typename U>
+    bool operator==(const HugePageAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const HugePageAllocator<U>&) const { return false; }
+};
+
+using KeyBlock = std::vector<int64_t, HugePageAllocator<int64_t>>;
+
+// 按输出顺序判断 a 是否应排在 b 之前
+template <bool Descending>
+inline bool KeyBefore(int64_t a, int64_t b) {
+    return Descending ? a > b : a < b;
+}
+
+// 无分支的比较交换，编译为条件传送
+template <bool Descending>
+inline void CompareExchange(int64_t& a, int64_t& b) {
+    bool swap = KeyBefore<Descending>(b, a);
+    int64_t first = swap ? b : a;
+    int64_t second = swap ? a : b;
+    a = first;
+    b = second;
+}
+
+// 8 个输入的最优排序网络（19 次比较交换，6 层）
+#define BLOCK_SORT_NETWORK_8(CE) \
+    CE(0, 2); CE(1, 3); CE(4, 6); CE(5, 7); \
+    CE(0, 4); CE(1, 5); CE(2, 6); CE(3, 7); \
+    CE(0, 1); CE(2, 3); CE(4, 5); CE(6, 7); \
+    CE(2, 4); CE(3, 5); \
+    CE(1, 4); CE(3, 6); \
+    CE(1, 2); CE(3, 4); CE(5, 6)
+
+template <bool Descending>
+inline void SortTile8(int64_t* keys) {
+#define BLOCK_SORT_SCALAR_CE(i, j) CompareExchange<Descending>(keys[i], keys[j])
+    BLOCK_SORT_NETWORK_8(BLOCK_SORT_SCALAR_CE);
+#undef BLOCK_SORT_SCALAR_CE
+}
+
+#if defined(__AVX2__)
+// 一次排好 4 组各 8 个键：8 个寄存器的第 j 个通道组成第 j 列，排序网络对 4 列同时执行，
+// 再把 8x4 的矩阵转置回来，使每一列连续存放
+template <bool Descending>
+inline void SortTiles32(int64_t* keys) {
+    __m256i r[8];
+    for (int i = 0; i < 8; ++i) {
+        r[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i * 4));
+    }
+#define BLOCK_SORT_SIMD_CE(i, j)                                                      \
+    do {                                                                              \
+        __m256i greater = _mm256_cmpgt_epi64(r[i], r[j]);                             \
+        __m256i low = _mm256_blendv_epi8(r[i], r[j], greater);                        \
+        __m256i high = _mm256_blendv_epi8(r[j], r[i], greater);                       \
+        r[i] = Descending ? high : low;                                               \
+        r[j] = Descending ? low : high;                                               \
+    } while (0)
+    BLOCK_SORT_NETWORK_8(BLOCK_SORT_SIMD_CE);
+#undef BLOCK_SORT_SIMD_CE
+    for (int half = 0; half < 2; ++half) {
+        __m256i* q = r + half * 4;
+        __m256i t0 = _mm256_unpacklo_epi64(q[0], q[1]);
+        __m256i t1 = _mm256_unpackhi_epi64(q[0], q[1]);
+        __m256i t2 = _mm256_unpacklo_epi64(q[2], q[3]);
+        __m256i t3 = _mm256_unpackhi_epi64(q[2], q[3]);
+        __m256i columns[4] = {_mm256_permute2x128_si256(t0, t2, 0x20), _mm256_permute2x128_si256(t1, t3, 0x20),
+                              _mm256_permute2x128_si256(t0, t2, 0x31), _mm256_permute2x128_si256(t1, t3, 0x31)};
+        for (int j = 0; j < 4; ++j) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(keys + j * 8 + half * 4), columns[j]);
+        }
+    }
+}
+#endif
+
+// 把 [0, count) 中每 SORT_TILE_KEYS 个键排好，最后不足一组的用插入排序
+template <bool Descending>
+inline void SortTiles(int64_t* keys, size_t count) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 * SORT_TILE_KEYS <= count; i += 4 * SORT_TILE_KEYS) {
+        SortTiles32<Descending>(keys + i);
+    }
+#endif
+    for (; i + SORT_TILE_KEYS <= count; i += SORT_TILE_KEYS) {
+        SortTile8<Descending>(keys + i);
+    }
+    for (size_t j = i + 1; j < count; ++j) {
+        int64_t key = keys[j];
+        size_t k = j;
+        while (k > i && KeyBefore<Descending>(key, keys[k - 1])) {
+            keys[k] = keys[k - 1];
+            --k;
+        }
+        keys[k] = key;
+    }
+}
+
+// 无分支的两路归并：每一步按比较结果前移其中一个指针
+template <bool Descending>
+inline void MergeTwo(const int64_t* a, const int64_t* a_end, const int64_t* b, const int64_t* b_end, int64_t* out) {
+    while (a != a_end && b != b_end) {
+        bool take_b = KeyBefore<Descending>(*b, *a);
+        *out++ = take_b ? *b : *a;
+        b += take_b;
+        a += !take_b;
+    }
+    out = std::copy(a, a_end, out);
+    std::copy(b, b_end, out);
+}
+
+// 排序一个分块，scratch 至少能容纳 count 个键
+template <bool Descending>
+inline void SortChunk(int64_t* keys, size_t count, int64_t* scratch) {
+    SortTiles<Descending>(keys, count);
+    int64_t* from = keys;
+    int64_t* to = scratch;
+    for (size_t width = SORT_TILE_KEYS; width < count; width *= 2) {
+        for (size_t begin = 0; begin < count; begin += 2 * width) {
+            size_t middle = std::min(begin + width, count);
+            size_t end = std::min(begin + 2 * width, count);
+            MergeTwo<Descending>(from + begin, from + middle, from + middle, from + end, to + begin);
+        }
+        std::swap(from, to);
+    }
+    if (from != keys) {
+        std::copy(from, from + count, keys);
+    }
+}
+
+// 把 [0, count) 按 chunk_keys 切成分块，分别排序
+template <bool Descending>
+inline void SortChunks(int64_t* keys, size_t count, int64_t* scratch, size_t chunk_keys) {
+    for (size_t begin = 0; begin < count; begin += chunk_keys) {
+        SortChunk<Descending>(keys + begin, std::min(chunk_keys, count - begin), scratch);
+    }
+}
+
+// 用败者树多路归并各个已排序的分块。内部节点记录比赛的败者，树根之上单独记录冠军；
+// 取走冠军后它所在的分块前进一个键，只需沿这个叶子到根的路径重赛一次。
+// 各分块当前的键连续存放在 heads_ 中，重赛时用条件传送交换胜者，路径上没有分支
+template <bool Descending>
+class ChunkMerger {
+public:
+    ChunkMerger(const int64_t* keys, size_t count, size_t chunk_keys) : remaining_(count) {
+        for (size_t begin = 0; begin < count; begin += chunk_keys) {
+            cursors_.push_back({keys + begin, keys + std::min(begin + chunk_keys, count)});
+            heads_.push_back(keys[begin]);
+        }
+        size_t leaves = cursors_.size();
+        exhausted_.assign(leaves, 0);
+        if (leaves == 0) {
+            return;
+        }
+        // 叶子 i 位于节点 leaves + i，节点 n 的父节点是 n / 2
+        losers_.resize(leaves);
+        std::vector<uint32_t> winners(2 * leaves);
+        for (size_t i = 0; i < leaves; ++i) {
+            winners[leaves + i] = static_cast<uint32_t>(i);
+        }
+        for (size_t node = leaves - 1; node >= 1; --node) {
+            uint32_t left = winners[2 * node];
+            uint32_t right = winners[2 * node + 1];
+            bool left_wins = Beats(left, right);
+            winners[node] = left_wins ? left : right;
+            losers_[node] = left_wins ? right : left;
+        }
+        winner_ = winners[1];
+    }
+
+    // 按输出顺序取下一个键，所有分块都取完时返回 false
+    bool Next(int64_t& key) {
+        if (remaining_ == 0) {
+            return false;
+        }
+        --remaining_;
+        uint32_t winner = winner_;
+        key = heads_[winner];
+        Cursor& cursor = cursors_[winner];
+        if (++cursor.pos == cursor.end) {
+            exhausted_[winner] = 1;
+        } else {
+            heads_[winner] = *cursor.pos;
+        }
+        for (size_t node = (cursors_.size() + winner) / 2; node >= 1; node /= 2) {
+            // 用掩码交换而不是条件表达式，编译器才不会把它变回分支
+            uint32_t other = losers_[node];
+            uint32_t diff = (other ^ winner) & (0u - static_cast<uint32_t>(Beats(other, winner)));
+            losers_[node] = other ^ diff;
+            winner ^= diff;
+        }
+        winner_ = winner;
+        return true;
+    }
+
+private:
+    struct Cursor {
+        const int64_t* pos;
+        const int64_t* end;
+    };
+
+    std::vector<Cursor> cursors_;
+    std::vector<int64_t> heads_;
+    std::vector<uint8_t> exhausted_;
+    std::vector<uint32_t> losers_;
+    uint32_t winner_ = 0;
+    size_t remaining_;
+
+    // 按（是否取完，当前键）比较，取完的分块视为无穷大，总是输掉比赛；
+    // 两个标志之差为 1 或 -1 时决定结果，为 0 时由键的比较决定
+    bool Beats(uint32_t a, uint32_t b) const {
+        int rank = static_cast<int>(exhausted_[b]) - static_cast<int>(exhausted_[a]);
+        return rank + static_cast<int>(KeyBefore<Descending>(heads_[a], heads_[b])) > 0;
+    }
+};
+
+#endif // BLOCK_SORT_H
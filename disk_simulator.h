@@ -0,0 +1,573 @@
+#ifndef DISK_SIMULATOR_H
+#define DISK_SIMULATOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+// 磁盘模拟库，用于在开发机上复现生产环境的慢速磁盘。
+// 排序程序的数据文件都通过 DiskFileBuf 读写，它直接调用 read/write，每次读写都作为一个请求提交给
+// 文件所在目录对应的模拟磁盘，并阻塞到请求在模拟磁盘上完成。模拟磁盘有两个令牌桶（带宽和 IOPS）
+// 和一个延迟队列：队列中的每个槽位同时服务一个请求，请求占用槽位的时间是固定延迟、
+// 不连续访问时的寻道时间以及等待令牌的时间。没有配置模拟磁盘的目录照常读写，不受影响。
+
+using DiskClock = std::chrono::steady_clock;
+
+struct DiskProfile {
+    std::string name;
+    double bandwidth = 0;     // 字节/秒，0 表示不限
+    double iops = 0;          // 每秒请求数，0 表示不限
+    double latency = 0;       // 每个请求的固定延迟（秒）
+    double seek = 0;          // 与上一个请求不连续时额外的寻道时间（秒）
+    size_t queue_depth = 1;   // 能同时处理的请求数
+    size_t max_request = 0;   // 单个请求的最大字节数，更大的读写拆成多个请求，0 表示不拆
+};
+
+// 预置的磁盘类型
+inline bool PresetDiskProfile(const std::string& name, DiskProfile& profile) {
+    profile = DiskProfile();
+    profile.name = name;
+    if (name == "hdd") {
+        // 7200 转机械硬盘：顺序读写 160MB/s，不连续访问要寻道和等待旋转，一次只能处理一个请求
+        profile.bandwidth = 160e6;
+        profile.latency = 100e-6;
+        profile.seek = 8e-3;
+        profile.queue_depth = 1;
+        profile.max_request = 1 << 20;
+    } else if (name == "sata") {
+        // SATA 固态硬盘：接口限制在 520MB/s，NCQ 队列深度 32
+        profile.bandwidth = 520e6;
+        profile.iops = 90e3;
+        profile.latency = 80e-6;
+        profile.queue_depth = 32;
+        profile.max_request = 512 << 10;
+    } else if (name == "nvme") {
+        // NVMe 固态硬盘：PCIe 3.0 x4，队列很深
+        profile.bandwidth = 3e9;
+        profile.iops = 500e3;
+        profile.latency = 20e-6;
+        profile.queue_depth = 64;
+        profile.max_request = 1 << 20;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// 解析带单位的数：字节数支持 K/M/G，时间支持 s/ms/us
+inline bool ParseDiskNumber(const std::string& text, double& value, bool is_time) {
+    size_t pos = 0;
+    try {
+        value = std::stod(text, &pos);
+    } catch (const std::exception&) {
+        return false;
+    }
+    std::string unit = text.substr(pos);
+    if (is_time) {
+        if (unit == "ms") {
+            value *= 1e-3;
+        } else if (unit == "us") {
+            value *= 1e-6;
+        } else if (unit != "s" && !unit.empty()) {
+            return false;
+        }
+    } else if (unit == "K" || unit == "k") {
+        value *= 1 << 10;
+    } else if (unit == "M" || unit == "m") {
+        value *= 1 << 20;
+    } else if (unit == "G" || unit == "g") {
+        value *= 1 << 30;
+    } else if (!unit.empty()) {
+        return false;
+    }
+    return value >= 0;
+}
+
+// 解析磁盘配置：预置类型名，后面可以跟逗号分隔的覆盖项，或者只有覆盖项，例如
+//   hdd
+//   hdd,bw=80M
+//   bw=100M,iops=200,lat=5ms,seek=8ms,depth=1,req=1M
+inline bool ParseDiskProfile(const std::string& spec, DiskProfile& profile) {
+    profile = DiskProfile();
+    profile.name = "custom";
+    size_t begin = 0;
+    bool first = true;
+    while (begin <= spec.size()) {
+        size_t end = spec.find(',', begin);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string item = spec.substr(begin, end - begin);
+        begin = end + 1;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            if (!first || !PresetDiskProfile(item, profile)) {
+                return false;
+            }
+            first = false;
+            continue;
+        }
+        first = false;
+        std::string key = item.substr(0, eq);
+        std::string text = item.substr(eq + 1);
+        double value = 0;
+        if (key == "bw" && ParseDiskNumber(text, value, false)) {
+            profile.bandwidth = value;
+        } else if (key == "iops" && ParseDiskNumber(text, value, false)) {
+            profile.iops = value;
+        } else if (key == "lat" && ParseDiskNumber(text, value, true)) {
+            profile.latency = value;
+        } else if (key == "seek" && ParseDiskNumber(text, value, true)) {
+            profile.seek = value;
+        } else if (key == "depth" && ParseDiskNumber(text, value, false) && value >= 1) {
+            profile.queue_depth = static_cast<size_t>(value);
+        } else if (key == "req" && ParseDiskNumber(text, value, false)) {
+            profile.max_request = static_cast<size_t>(value);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 令牌桶：令牌以 rate 的速度产生，最多攒 burst 个。用“令牌用到哪个时刻”表示桶的状态，
+// 取令牌时返回令牌足够的时刻，不需要后台线程补充令牌
+class TokenBucket {
+public:
+    TokenBucket(double rate, double burst) : rate_(rate), burst_(burst) {}
+
+    // 在 earliest 之后取 amount 个令牌，返回可以开始的时刻
+    DiskClock::time_point Take(double amount, DiskClock::time_point earliest) {
+        if (rate_ <= 0) {
+            return earliest;
+        }
+        auto full = earliest - Seconds(burst_ / rate_);
+        drained_ = std::max(drained_, full) + Seconds(amount / rate_);
+        return std::max(earliest, drained_);
+    }
+
+private:
+    double rate_;
+    double burst_;
+    DiskClock::time_point drained_{};
+
+    static DiskClock::duration Seconds(double seconds) {
+        return std::chrono::duration_cast<DiskClock::duration>(std::chrono::duration<double>(seconds));
+    }
+};
+
+struct DiskStats {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t read_bytes = 0;
+    uint64_t write_bytes = 0;
+    uint64_t seeks = 0;
+    double service_seconds = 0; // 所有请求从开始服务到完成的时间之和
+    double wait_seconds = 0;    // 调用方被阻塞的时间之和，包括排队
+};
+
+class SimulatedDisk {
+public:
+    SimulatedDisk(const std::string& dir, const DiskProfile& profile)
+        : dir_(dir), profile_(profile), bandwidth_(profile.bandwidth, std::max<double>(profile.max_request, 1)),
+          iops_(profile.iops, 1) {
+        for (size_t i = 0; i < profile_.queue_depth; ++i) {
+            slots_.push(DiskClock::time_point{});
+        }
+    }
+
+    const std::string& Dir() const { return dir_; }
+    const DiskProfile& Profile() const { return profile_; }
+
+    DiskStats Stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    // 提交 file 中从 offset 开始的 bytes 字节的读写，阻塞到模拟磁盘完成为止
+    void Transfer(const void* file, uint64_t offset, size_t bytes, bool write) {
+        auto now = DiskClock::now();
+        DiskClock::time_point done = now;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t piece_limit = profile_.max_request == 0 ? bytes : profile_.max_request;
+            size_t remaining = bytes;
+            do {
+                size_t piece = std::min(remaining, piece_limit);
+                done = std::max(done, Submit(file, offset, piece, now));
+                offset += piece;
+                remaining -= piece;
+                ++(write ? stats_.writes : stats_.reads);
+            } while (remaining > 0);
+            (write ? stats_.write_bytes : stats_.read_bytes) += bytes;
+            stats_.wait_seconds += std::chrono::duration<double>(done - now).count();
+        }
+        std::this_thread::sleep_until(done);
+    }
+
+private:
+    std::string dir_;
+    DiskProfile profile_;
+    std::mutex mutex_;
+    TokenBucket bandwidth_;
+    TokenBucket iops_;
+    // 延迟队列：每个槽位空闲的时刻，最早空闲的在堆顶
+    std::priority_queue<DiskClock::time_point, std::vector<DiskClock::time_point>,
+                        std::greater<DiskClock::time_point>> slots_;
+    const void* last_file_ = nullptr;
+    uint64_t last_end_ = 0;
+    DiskStats stats_;
+
+    // 把一个请求放进最早空闲的槽位，返回它完成的时刻
+    DiskClock::time_point Submit(const void* file, uint64_t offset, size_t bytes, DiskClock::time_point now) {
+        auto start = std::max(now, slots_.top());
+        slots_.pop();
+        auto ready = start;
+        if (profile_.seek > 0 && (file != last_file_ || offset != last_end_)) {
+            ready += Seconds(profile_.seek);
+            ++stats_.seeks;
+        }
+        last_file_ = file;
+        last_end_ = offset + bytes;
+        ready = std::max(bandwidth_.Take(static_cast<double>(bytes), ready), iops_.Take(1, ready));
+        auto done = ready + Seconds(profile_.latency);
+        slots_.push(done);
+        stats_.service_seconds += std::chrono::duration<double>(done - start).count();
+        return done;
+    }
+
+    static DiskClock::duration Seconds(double seconds) {
+        return std::chrono::duration_cast<DiskClock::duration>(std::chrono::duration<double>(seconds));
+    }
+};
+
+// 目录到模拟磁盘的映射，按路径的最长目录前缀查找
+class DiskSimulator {
+public:
+    static DiskSimulator& Instance() {
+        static DiskSimulator simulator;
+        return simulator;
+    }
+
+    void Attach(const std::string& dir, const DiskProfile& profile) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        disks_.push_back(std::make_unique<SimulatedDisk>(Normalize(dir), profile));
+    }
+
+    bool Enabled() const { return !disks_.empty(); }
+
+    // path 所在的模拟磁盘，没有配置时返回 nullptr
+    SimulatedDisk* Find(const std::string& path) {
+        if (disks_.empty()) {
+            return nullptr;
+        }
+        std::string normalized = Normalize(path);
+        SimulatedDisk* best = nullptr;
+        for (const auto& disk : disks_) {
+            const std::string& dir = disk->Dir();
+            bool inside = normalized.size() > dir.size() && normalized.compare(0, dir.size(), dir) == 0 &&
+                          (dir.back() == '/' || normalized[dir.size()] == '/');
+            if (inside && (!best || dir.size() > best->Dir().size())) {
+                best = disk.get();
+            }
+        }
+        return best;
+    }
+
+    const std::vector<std::unique_ptr<SimulatedDisk>>& Disks() const { return disks_; }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<SimulatedDisk>> disks_;
+
+    static std::string Normalize(const std::string& path) {
+        std::string normalized = std::filesystem::absolute(path).lexically_normal().string();
+        while (normalized.size() > 1 && normalized.back() == '/') {
+            normalized.pop_back();
+        }
+        return normalized;
+    }
+};
+
+// 直接用 read/write 读写文件的流缓存，每次读写都提交给文件所在的模拟磁盘。
+// 与 std::filebuf 一样，pubsetbuf(nullptr, 0) 之后不带缓存，pubsetbuf(buffer, size) 使用调用方的缓存；
+// 没有调用 pubsetbuf 时也不带缓存
+class DiskFileBuf : public std::streambuf {
+public:
+    DiskFileBuf() = default;
+    DiskFileBuf(const DiskFileBuf&) = delete;
+    DiskFileBuf& operator=(const DiskFileBuf&) = delete;
+
+    ~DiskFileBuf() override { close(); }
+
+    DiskFileBuf* open(const std::string& path, std::ios::openmode mode) {
+        if (fd_ >= 0) {
+            return nullptr;
+        }
+        int flags;
+        if (mode & std::ios::out) {
+            flags = O_WRONLY | O_CREAT | ((mode & std::ios::app) ? O_APPEND : O_TRUNC);
+        } else {
+            flags = O_RDONLY;
+        }
+        fd_ = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            return nullptr;
+        }
+        writing_ = (mode & std::ios::out) != 0;
+        offset_ = 0;
+        disk_ = DiskSimulator::Instance().Find(path);
+        if (writing_ && buffer_size_ > 0) {
+            setp(buffer_, buffer_ + buffer_size_);
+        } else {
+            setg(buffer_, buffer_, buffer_);
+        }
+        return this;
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    DiskFileBuf* close() {
+        if (fd_ < 0) {
+            return nullptr;
+        }
+        bool ok = sync() == 0;
+        ok = ::close(fd_) == 0 && ok;
+        fd_ = -1;
+        setg(nullptr, nullptr, nullptr);
+        setp(nullptr, nullptr);
+        return ok ? this : nullptr;
+    }
+
+protected:
+    std::streambuf* setbuf(char* buffer, std::streamsize size) override {
+        if (fd_ >= 0) {
+            return nullptr; // 与 std::filebuf 一样，只能在打开之前设置
+        }
+        buffer_ = size > 0 ? buffer : nullptr;
+        buffer_size_ = buffer_ ? static_cast<size_t>(size) : 0;
+        return this;
+    }
+
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        if (fd_ < 0 || writing_) {
+            return traits_type::eof();
+        }
+        char* buffer = buffer_size_ > 0 ? buffer_ : &single_;
+        size_t size = buffer_size_ > 0 ? buffer_size_ : 1;
+        size_t got = ReadDevice(buffer, size);
+        setg(buffer, buffer, buffer + got);
+        return got == 0 ? traits_type::eof() : traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize xsgetn(char* out, std::streamsize count) override {
+        std::streamsize done = 0;
+        while (done < count) {
+            std::streamsize available = egptr() - gptr();
+            if (available > 0) {
+                std::streamsize n = std::min(available, count - done);
+                std::memcpy(out + done, gptr(), n);
+                gbump(static_cast<int>(n));
+                done += n;
+            } else if (static_cast<size_t>(count - done) >= buffer_size_) {
+                // 剩下的不比缓存小，直接读到调用方的内存
+                size_t got = ReadDevice(out + done, count - done);
+                done += got;
+                if (got == 0) {
+                    break;
+                }
+            } else if (traits_type::eq_int_type(underflow(), traits_type::eof())) {
+                break;
+            }
+        }
+        return done;
+    }
+
+    int_type overflow(int_type c) override {
+        if (fd_ < 0 || !writing_ || !FlushPut()) {
+            return traits_type::eof();
+        }
+        if (traits_type::eq_int_type(c, traits_type::eof())) {
+            return traits_type::not_eof(c);
+        }
+        char ch = traits_type::to_char_type(c);
+        if (buffer_size_ > 0) {
+            *pptr() = ch;
+            pbump(1);
+            return c;
+        }
+        return WriteDevice(&ch, 1) ? c : traits_type::eof();
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        if (fd_ < 0 || !writing_) {
+            return 0;
+        }
+        if (buffer_size_ > 0 && count <= epptr() - pptr()) {
+            std::memcpy(pptr(), data, count);
+            pbump(static_cast<int>(count));
+            return count;
+        }
+        if (!FlushPut() || !WriteDevice(data, count)) {
+            return 0;
+        }
+        return count;
+    }
+
+    int sync() override { return !writing_ || FlushPut() ? 0 : -1; }
+
+    // 只支持读取时定位，丢弃缓存中的数据；下一次读取与上一次不连续，模拟磁盘按寻道计算
+    pos_type seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode) override {
+        if (fd_ < 0 || writing_) {
+            return pos_type(off_type(-1));
+        }
+        if (dir == std::ios::cur) {
+            offset -= egptr() - gptr(); // 内核中的位置在缓存末尾
+        }
+        off_t position = ::lseek(fd_, offset, dir == std::ios::beg ? SEEK_SET : dir == std::ios::cur ? SEEK_CUR : SEEK_END);
+        if (position < 0) {
+            return pos_type(off_type(-1));
+        }
+        offset_ = static_cast<uint64_t>(position);
+        setg(buffer_, buffer_, buffer_);
+        return pos_type(position);
+    }
+
+    pos_type seekpos(pos_type position, std::ios::openmode which) override {
+        return seekoff(off_type(position), std::ios::beg, which);
+    }
+
+private:
+    int fd_ = -1;
+    bool writing_ = false;
+    char* buffer_ = nullptr;
+    size_t buffer_size_ = 0;
+    char single_ = 0; // 不带缓存时 underflow 需要的一个字节
+    uint64_t offset_ = 0;
+    SimulatedDisk* disk_ = nullptr;
+
+    // 读到 size 字节或文件结束，作为一个请求提交
+    size_t ReadDevice(char* out, size_t size) {
+        size_t got = 0;
+        while (got < size) {
+            ssize_t n = ::read(fd_, out + got, size - got);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            got += n;
+        }
+        if (disk_ && got > 0) {
+            disk_->Transfer(this, offset_, got, false);
+        }
+        offset_ += got;
+        return got;
+    }
+
+    bool WriteDevice(const char* data, size_t size) {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t n = ::write(fd_, data + written, size - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            written += n;
+        }
+        if (disk_ && size > 0) {
+            disk_->Transfer(this, offset_, size, true);
+        }
+        offset_ += size;
+        return true;
+    }
+
+    bool FlushPut() {
+        if (buffer_size_ == 0 || pbase() == pptr()) {
+            return true;
+        }
+        bool ok = WriteDevice(pbase(), pptr() - pbase());
+        setp(buffer_, buffer_ + buffer_size_);
+        return ok;
+    }
+};
+
+// 接口与 std::ifstream / std::ofstream 中排序程序用到的部分相同
+class DiskInputFile : public std::istream {
+public:
+    DiskInputFile() : std::istream(nullptr) { std::istream::rdbuf(&buffer_); }
+    explicit DiskInputFile(const std::string& path, std::ios::openmode mode = std::ios::in) : DiskInputFile() {
+        open(path, mode);
+    }
+
+    DiskFileBuf* rdbuf() { return &buffer_; }
+    bool is_open() const { return buffer_.is_open(); }
+
+    void open(const std::string& path, std::ios::openmode mode = std::ios::in) {
+        if (buffer_.open(path, (mode | std::ios::in) & ~std::ios::out)) {
+            clear();
+        } else {
+            setstate(std::ios::failbit);
+        }
+    }
+
+    void close() {
+        if (!buffer_.close()) {
+            setstate(std::ios::failbit);
+        }
+    }
+
+private:
+    DiskFileBuf buffer_;
+};
+
+class DiskOutputFile : public std::ostream {
+public:
+    DiskOutputFile() : std::ostream(nullptr) { std::ostream::rdbuf(&buffer_); }
+    explicit DiskOutputFile(const std::string& path, std::ios::openmode mode = std::ios::out) : DiskOutputFile() {
+        open(path, mode);
+    }
+
+    DiskFileBuf* rdbuf() { return &buffer_; }
+    bool is_open() const { return buffer_.is_open(); }
+
+    void open(const std::string& path, std::ios::openmode mode = std::ios::out) {
+        if (buffer_.open(path, mode | std::ios::out)) {
+            clear();
+        } else {
+            setstate(std::ios::failbit);
+        }
+    }
+
+    void close() {
+        if (!buffer_.close()) {
+            setstate(std::ios::failbit);
+        }
+    }
+
+private:
+    DiskFileBuf buffer_;
+};
+
+#endif // DISK_SIMULATOR_H
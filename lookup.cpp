@@ -0,0 +1,55 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "sorted_index.h"
+#include "text_parser.h"
+
+// 通过 .idx 稀疏索引查询排序结果
+//   lookup <排序结果文件> get <键>
+//   lookup <排序结果文件> range <下界> <上界>
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "用法: " << argv[0] << " <排序结果文件> get <键> | range <下界> <上界>" << std::endl;
+        return 1;
+    }
+
+    std::string data_file = argv[1];
+    std::string command = argv[2];
+
+    SortedIndex index;
+    if (!index.Open(data_file)) {
+        std::cerr << "无法打开索引: " << data_file << INDEX_SUFFIX << std::endl;
+        return 1;
+    }
+
+    if (command == "get") {
+        int64_t key;
+        if (!ParseArgument(argv[3], INT64_MIN, INT64_MAX, key)) {
+            std::cerr << "无效的键: " << argv[3] << std::endl;
+            return 1;
+        }
+        uint64_t count = 0;
+        if (index.Find(key, &count)) {
+            std::cout << key << " 存在，计数 " << count << std::endl;
+        } else {
+            std::cout << key << " 不存在" << std::endl;
+        }
+    } else if (command == "range" && argc >= 5) {
+        int64_t lo;
+        int64_t hi;
+        if (!ParseArgument(argv[3], INT64_MIN, INT64_MAX, lo) || !ParseArgument(argv[4], INT64_MIN, INT64_MAX, hi)) {
+            std::cerr << "无效的范围: " << argv[3] << " " << argv[4] << std::endl;
+            return 1;
+        }
+        std::vector<int64_t> keys;
+        index.Range(lo, hi, keys);
+        for (int64_t key : keys) {
+            std::cout << key << std::endl;
+        }
+        std::cout << "共 " << keys.size() << " 个键" << std::endl;
+    } else {
+        std::cerr << "未知命令: " << command << std::endl;
+        return 1;
+    }
+    return 0;
+}
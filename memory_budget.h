@@ -0,0 +1,236 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// 排序程序的内存预算。
+// 所有按数据量分配的缓存（数据块、读写缓存、归并输入缓存等）都要先在预算中登记，登记失败就不分配，
+// 因此这些缓存的总和不会超过预算。预算默认取 cgroup v2 的 memory.max 的一半；
+// 运行期间定期读取 cgroup 的用量和 PSI 内存压力，压力升高时把压力系数减半，
+// 排序程序据此缩小数据块和归并路数，压力消失后再逐步恢复。
+
+// 本进程所在的 cgroup v2 目录，找不到时返回空字符串
+inline std::string FindCgroupDir() {
+    std::ifstream cgroup("/proc/self/cgroup");
+    std::string line;
+    std::string relative;
+    while (std::getline(cgroup, line)) {
+        if (line.rfind("0::", 0) == 0) {
+            relative = line.substr(3);
+        }
+    }
+    if (relative.empty()) {
+        return "";
+    }
+
+    // mountinfo 的第 5 列是挂载点，" - " 之后是文件系统类型
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    while (std::getline(mountinfo, line)) {
+        size_t dash = line.find(" - ");
+        if (dash == std::string::npos || line.compare(dash + 3, 8, "cgroup2 ") != 0) {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string field;
+        std::string mount_point;
+        for (int i = 0; i < 5 && fields >> field; ++i) {
+            mount_point = field;
+        }
+        return relative == "/" ? mount_point : mount_point + relative;
+    }
+    return "";
+}
+
+// 读取只含一个整数的 cgroup 文件，内容为 "max" 或读取失败时返回 false
+inline bool ReadCgroupValue(const std::string& path, uint64_t& value) {
+    std::ifstream input(path);
+    std::string text;
+    if (!(input >> text) || text == "max") {
+        return false;
+    }
+    try {
+        value = std::stoull(text);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// 读取 memory.stat 中的一项，例如可以随时回收的 inactive_file
+inline uint64_t ReadCgroupStat(const std::string& path, const std::string& name) {
+    std::ifstream input(path);
+    std::string key;
+    uint64_t value = 0;
+    while (input >> key >> value) {
+        if (key == name) {
+            return value;
+        }
+    }
+    return 0;
+}
+
+// 读取 PSI 文件中 "some" 一行的 avg10（最近 10 秒内有任务因内存而停顿的时间百分比），失败时返回 -1
+inline double ReadPressureAvg10(const std::string& path) {
+    std::ifstream input(path);
+    std::string line;
+    while (std::getline(input, line)) {
+        size_t pos = line.find("avg10=");
+        if (line.rfind("some", 0) == 0 && pos != std::string::npos) {
+            return std::atof(line.c_str() + pos + 6);
+        }
+    }
+    return -1;
+}
+
+class MemoryBudget {
+public:
+    static constexpr double kHighPressure = 10.0; // avg10 超过这个百分比时收缩
+    static constexpr double kLowPressure = 1.0;   // avg10 低于这个百分比时恢复
+    static constexpr int kMaxShrinkShift = 4;     // 最多收缩到 1/16
+    static constexpr std::chrono::milliseconds kSampleInterval{250};
+
+    // limit 为 0 时取 cgroup 的 memory.max 的一半（至少为 default_limit），没有 cgroup 限制时使用 default_limit
+    MemoryBudget(size_t limit, size_t default_limit) {
+        cgroup_dir_ = FindCgroupDir();
+        uint64_t cgroup_max = 0;
+        bool limited = !cgroup_dir_.empty() && ReadCgroupValue(cgroup_dir_ + "/memory.max", cgroup_max);
+        if (limit == 0) {
+            limit = limited ? std::max<size_t>(cgroup_max / 2, default_limit) : default_limit;
+        }
+        limit_ = limit;
+        if (limited) {
+            cgroup_max_ = cgroup_max;
+        }
+        pressure_path_ = !cgroup_dir_.empty() && std::ifstream(cgroup_dir_ + "/memory.pressure").good()
+            ? cgroup_dir_ + "/memory.pressure" : "/proc/pressure/memory";
+        Sample(true);
+    }
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    size_t Limit() const { return limit_; }
+    size_t Used() const { return used_.load(); }
+    size_t Peak() const { return peak_.load(); }
+    size_t ShrinkEvents() const { return shrink_events_.load(); }
+    size_t GrowEvents() const { return grow_events_.load(); }
+    bool CgroupLimited() const { return cgroup_max_ != 0; }
+
+    // 在预算内登记 bytes 字节，超出预算时不登记并返回 false
+    bool TryReserve(size_t bytes) {
+        size_t used = used_.load();
+        do {
+            if (bytes > limit_ - used) {
+                return false;
+            }
+        } while (!used_.compare_exchange_weak(used, used + bytes));
+        size_t peak = peak_.load();
+        while (used + bytes > peak && !peak_.compare_exchange_weak(peak, used + bytes)) {
+        }
+        return true;
+    }
+
+    void Release(size_t bytes) { used_ -= bytes; }
+
+    // 现在还能用于新缓存的字节数：预算剩余部分，并且不超过 cgroup 剩余空间的一半
+    size_t Available() {
+        Sample(false);
+        size_t free_bytes = limit_ - std::min(limit_, used_.load());
+        return std::min<uint64_t>(free_bytes, cgroup_headroom_.load() / 2);
+    }
+
+    // 压力系数，1 表示没有压力；调用方把它乘到块大小和归并路数的目标上
+    double Scale() {
+        Sample(false);
+        return 1.0 / (1 << shrink_shift_.load());
+    }
+
+private:
+    size_t limit_ = 0;
+    uint64_t cgroup_max_ = 0; // 0 表示 cgroup 没有内存上限
+    std::string cgroup_dir_;
+    std::string pressure_path_;
+    std::atomic<size_t> used_{0};
+    std::atomic<size_t> peak_{0};
+    std::atomic<uint64_t> cgroup_headroom_{UINT64_MAX};
+    std::atomic<int> shrink_shift_{0};
+    std::atomic<size_t> shrink_events_{0};
+    std::atomic<size_t> grow_events_{0};
+    std::mutex sample_mutex_;
+    std::chrono::steady_clock::time_point last_sample_;
+
+    // 最多每 kSampleInterval 读取一次 cgroup 用量和 PSI；其他线程正在采样时直接使用上一次的结果
+    void Sample(bool force) {
+        std::unique_lock<std::mutex> lock(sample_mutex_, std::try_to_lock);
+        auto now = std::chrono::steady_clock::now();
+        if (!lock.owns_lock() || (!force && now - last_sample_ < kSampleInterval)) {
+            return;
+        }
+        last_sample_ = now;
+
+        // 页缓存中不活跃的文件页可以随时回收，不算作已用
+        uint64_t current = 0;
+        if (cgroup_max_ != 0 && ReadCgroupValue(cgroup_dir_ + "/memory.current", current)) {
+            uint64_t reclaimable = ReadCgroupStat(cgroup_dir_ + "/memory.stat", "inactive_file");
+            uint64_t in_use = current - std::min(current, reclaimable);
+            cgroup_headroom_ = cgroup_max_ - std::min(cgroup_max_, in_use);
+        }
+
+        double pressure = ReadPressureAvg10(pressure_path_);
+        int shift = shrink_shift_.load();
+        if (pressure >= kHighPressure && shift < kMaxShrinkShift) {
+            shrink_shift_ = shift + 1;
+            ++shrink_events_;
+        } else if (pressure >= 0 && pressure < kLowPressure && shift > 0) {
+            shrink_shift_ = shift - 1;
+            ++grow_events_;
+        }
+    }
+};
+
+// 在预算中登记的一段内存，析构时归还
+class MemoryReservation {
+public:
+    // 登记失败时抛出 std::runtime_error
+    MemoryReservation(MemoryBudget& budget, size_t bytes, const char* what) : budget_(budget) {
+        if (!budget_.TryReserve(bytes)) {
+            throw std::runtime_error(std::string("内存预算不足，无法分配") + what + " (" + std::to_string(bytes) +
+                                     " 字节，预算 " + std::to_string(budget_.Limit()) + " 字节)");
+        }
+        size_ = bytes;
+    }
+
+    MemoryReservation(const MemoryReservation&) = delete;
+    MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+    ~MemoryReservation() { budget_.Release(size_); }
+
+    size_t Size() const { return size_; }
+
+    // 调整登记的大小，变大时超出预算返回 false 并保持原来的大小
+    bool Resize(size_t bytes) {
+        if (bytes > size_ && !budget_.TryReserve(bytes - size_)) {
+            return false;
+        }
+        if (bytes < size_) {
+            budget_.Release(size_ - bytes);
+        }
+        size_ = bytes;
+        return true;
+    }
+
+private:
+    MemoryBudget& budget_;
+    size_t size_ = 0;
+};
+
+#endif // MEMORY_BUDGET_H
@@ -0,0 +1,230 @@
+#ifndef SHUFFLE_NET_H
+#define SHUFFLE_NET_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// 分布式排序的套接字工具：监听、连接，以及在流式套接字上完整地收发数据。
+// 支持 Unix 域套接字（同一台机器上的多个进程）和 TCP；地址统一写成字符串，
+// "unix:<路径>" 或 "tcp:<IPv4 地址>:<端口>"，便于在进程之间传递。
+
+const int CONNECT_RETRY_MS = 100; // 对方还没有开始监听时重试连接的间隔
+
+// 解析 "<IPv4 地址>:<端口>"，端口为 0 表示监听时由系统分配
+inline bool ParseTcpAddress(const std::string& text, sockaddr_in& addr) {
+    size_t colon = text.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string port = text.substr(colon + 1);
+    if (port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos ||
+        std::stoul(port) > 65535) {
+        return false;
+    }
+    addr = sockaddr_in{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(std::stoul(port)));
+    return ::inet_pton(AF_INET, text.substr(0, colon).c_str(), &addr.sin_addr) == 1;
+}
+
+// 持有一个文件描述符，析构时关闭；出错抛出异常的路径因此不会泄漏，成功时用 Release 交出
+class FdGuard {
+public:
+    FdGuard() = default;
+    FdGuard(const FdGuard&) = delete;
+    FdGuard& operator=(const FdGuard&) = delete;
+
+    ~FdGuard() { Reset(-1); }
+
+    int Get() const { return fd_; }
+
+    void Reset(int fd) {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        fd_ = fd;
+    }
+
+    int Release() {
+        int fd = fd_;
+        fd_ = -1;
+        return fd;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+// 创建监听套接字。transport 为 "unix" 时 where 是套接字文件的路径，为 "tcp" 时 where 是监听的
+// "<IPv4 地址>:<端口>"（例如本机测试用的 "127.0.0.1:0"，多台机器时的 "0.0.0.0:7000"）；
+// 返回监听的文件描述符，address 为其他进程连接时使用的地址
+inline int ListenSocket(const std::string& transport, const std::string& where, int backlog, std::string& address) {
+    FdGuard fd;
+    if (transport == "unix") {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (where.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("套接字路径太长: " + where);
+        }
+        std::strcpy(addr.sun_path, where.c_str());
+        ::unlink(where.c_str());
+        fd.Reset(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if (fd.Get() < 0 || ::bind(fd.Get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("无法监听 " + where + ": " + std::strerror(errno));
+        }
+        address = "unix:" + where;
+    } else if (transport == "tcp") {
+        sockaddr_in addr;
+        if (!ParseTcpAddress(where, addr)) {
+            throw std::runtime_error("无效的监听地址: " + where);
+        }
+        fd.Reset(::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        // 固定端口的工作进程重新启动时，上次的连接可能还处于 TIME_WAIT
+        int one = 1;
+        socklen_t length = sizeof(addr);
+        if (fd.Get() < 0 || ::setsockopt(fd.Get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            ::bind(fd.Get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            ::getsockname(fd.Get(), reinterpret_cast<sockaddr*>(&addr), &length) != 0) {
+            throw std::runtime_error("无法监听 " + where + ": " + std::strerror(errno));
+        }
+        address = "tcp:" + where.substr(0, where.rfind(':')) + ":" + std::to_string(ntohs(addr.sin_port));
+    } else {
+        throw std::runtime_error("未知的传输方式: " + transport);
+    }
+    if (::listen(fd.Get(), backlog) != 0) {
+        throw std::runtime_error(std::string("listen 失败: ") + std::strerror(errno));
+    }
+    return fd.Release();
+}
+
+// 连接到 ListenSocket 返回的地址。wait_ms 大于 0 时，对方还没有开始监听（连接被拒绝或套接字文件不存在）
+// 就每隔 CONNECT_RETRY_MS 毫秒重试，最多等待 wait_ms 毫秒；多台机器上的工作进程启动的先后不定
+inline int ConnectSocket(const std::string& address, int wait_ms = 0) {
+    sockaddr_un unix_addr{};
+    sockaddr_in tcp_addr{};
+    bool tcp = address.rfind("tcp:", 0) == 0;
+    if (address.rfind("unix:", 0) == 0) {
+        unix_addr.sun_family = AF_UNIX;
+        std::strncpy(unix_addr.sun_path, address.substr(5).c_str(), sizeof(unix_addr.sun_path) - 1);
+    } else if (!tcp || !ParseTcpAddress(address.substr(4), tcp_addr)) {
+        throw std::runtime_error("无效的地址: " + address);
+    }
+    for (int waited = 0;; waited += CONNECT_RETRY_MS) {
+        int fd = ::socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int result = -1;
+        if (fd >= 0 && tcp) {
+            // 批量发送已经攒够了数据，不需要 Nagle 算法再等待
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            result = ::connect(fd, reinterpret_cast<sockaddr*>(&tcp_addr), sizeof(tcp_addr));
+        } else if (fd >= 0) {
+            result = ::connect(fd, reinterpret_cast<sockaddr*>(&unix_addr), sizeof(unix_addr));
+        }
+        if (result == 0) {
+            return fd;
+        }
+        int error = errno;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if ((error != ECONNREFUSED && error != ENOENT) || waited >= wait_ms) {
+            throw std::runtime_error("无法连接 " + address + ": " + std::strerror(error));
+        }
+        ::usleep(CONNECT_RETRY_MS * 1000);
+    }
+}
+
+// 写出全部数据，失败时抛出 std::runtime_error
+inline void SendAll(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(std::string("发送失败: ") + std::strerror(errno));
+        }
+        p += n;
+        size -= n;
+    }
+}
+
+// 读满 size 字节，返回实际读到的字节数；对方关闭连接时可能少于 size
+inline size_t ReceiveAll(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = ::recv(fd, p + got, size - got, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error(std::string("接收失败: ") + std::strerror(errno));
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+// 从套接字按固定长度的记录读取，每次从内核取一批，记录可以跨越两批
+class SocketRecordReader {
+public:
+    SocketRecordReader(int fd, size_t buffer_size) : fd_(fd), buffer_(buffer_size) {}
+
+    // 读取一条 size 字节的记录，对方发送完毕时返回 false；连接在记录中间断开时抛出异常
+    bool Read(void* record, size_t size) {
+        char* out = static_cast<char*>(record);
+        size_t copied = 0;
+        while (copied < size) {
+            if (pos_ == end_) {
+                ssize_t n;
+                do {
+                    n = ::recv(fd_, buffer_.data(), buffer_.size(), 0);
+                } while (n < 0 && errno == EINTR);
+                if (n < 0) {
+                    throw std::runtime_error(std::string("接收失败: ") + std::strerror(errno));
+                }
+                if (n == 0) {
+                    if (copied != 0) {
+                        throw std::runtime_error("连接在记录中间断开");
+                    }
+                    return false;
+                }
+                bytes_ += n;
+                pos_ = 0;
+                end_ = static_cast<size_t>(n);
+            }
+            size_t n = std::min(size - copied, end_ - pos_);
+            std::memcpy(out + copied, buffer_.data() + pos_, n);
+            pos_ += n;
+            copied += n;
+        }
+        return true;
+    }
+
+    uint64_t Bytes() const { return bytes_; }
+
+private:
+    int fd_;
+    std::vector<char> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    uint64_t bytes_ = 0;
+};
+
+#endif // SHUFFLE_NET_H
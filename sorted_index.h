@@ -0,0 +1,320 @@
+#ifndef SORTED_INDEX_H
+#define SORTED_INDEX_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 排序结果的稀疏索引，保存在与输出文件同名、后缀为 .idx 的旁路文件中，输出文件本身的格式不变。
+// 输出按每 keys_per_block 条记录划分为块，索引记录每块的最小键、最大键、偏移和记录数，
+// 可选地为每块保存一个 Bloom 过滤器。索引常驻内存，点查和范围查询只需读取一到两次数据文件。
+//
+// 文件布局：IndexHeader | IndexBlock * block_count | Bloom 过滤器 * block_count
+
+const char INDEX_MAGIC[8] = {'S', 'O', 'R', 'T', 'I', 'D', 'X', '1'};
+const char* const INDEX_SUFFIX = ".idx";
+const size_t INDEX_WRITE_BUFFER = 1024; // 生成索引时块边界的写出缓存，可以容纳 32 个块
+const uint32_t MAX_BLOOM_BITS = 64; // 每个键最多占用的 Bloom 过滤器比特数，再多误判率也不会明显下降
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t record_size; // 每条记录的字节数，计数模式下为 16
+    uint32_t bloom_hashes; // Bloom 过滤器的哈希函数个数，0 表示没有过滤器
+    uint64_t keys_per_block; // 每块的记录数
+    uint64_t total_count; // 记录总数
+    uint64_t block_count; // 块数
+    uint64_t bloom_bytes; // 每块 Bloom 过滤器的字节数
+};
+
+struct IndexBlock {
+    int64_t min_key;
+    int64_t max_key;
+    uint64_t offset; // 块在数据文件中的字节偏移
+    uint64_t count; // 块内的记录数
+};
+
+// Bloom 过滤器使用的键哈希（splitmix64 的混合函数）
+inline uint64_t MixKey(int64_t key) {
+    uint64_t x = static_cast<uint64_t>(key) + 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// 双重哈希得到第 i 个比特位置
+inline uint64_t BloomBit(uint64_t hash, uint32_t i, uint64_t bits) {
+    return (hash + i * ((hash >> 32) | 1)) % bits;
+}
+
+// 在写出排序结果的同时按顺序接收每条记录的键，生成索引。
+// 内存中只保留当前块的边界和 Bloom 过滤器：写完的块边界直接追加到索引文件，过滤器先写到旁边的
+// .bloom 临时文件，Finish 时再接到块边界后面，所以占用的内存与输出的大小无关
+class IndexBuilder {
+public:
+    IndexBuilder(const std::string& index_path, uint32_t record_size, uint64_t keys_per_block,
+                 uint32_t bloom_bits_per_key)
+        : index_path_(index_path), bloom_path_(index_path + ".bloom") {
+        std::memcpy(header_.magic, INDEX_MAGIC, sizeof(header_.magic));
+        header_.record_size = record_size;
+        header_.keys_per_block = std::max<uint64_t>(keys_per_block, 1);
+        header_.total_count = 0;
+        header_.block_count = 0;
+        header_.bloom_bytes = BloomBytes(header_.keys_per_block, bloom_bits_per_key);
+        header_.bloom_hashes = bloom_bits_per_key == 0
+            ? 0 : std::max<uint32_t>(1, static_cast<uint32_t>(std::lround(bloom_bits_per_key * 0.69)));
+        bloom_.resize(header_.bloom_bytes);
+        // 文件头在 Finish 时改写，先占住位置；过滤器整块写出，不需要文件流的缓存
+        index_.rdbuf()->pubsetbuf(buffer_, sizeof(buffer_));
+        index_.open(index_path_, std::ios::binary | std::ios::trunc);
+        index_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+        if (header_.bloom_bytes > 0) {
+            blooms_.rdbuf()->pubsetbuf(nullptr, 0);
+            blooms_.open(bloom_path_, std::ios::binary | std::ios::trunc);
+        }
+    }
+
+    IndexBuilder(const IndexBuilder&) = delete;
+    IndexBuilder& operator=(const IndexBuilder&) = delete;
+
+    // 没有完成的索引不留下任何文件
+    ~IndexBuilder() {
+        if (!finished_) {
+            index_.close();
+            blooms_.close();
+            std::remove(index_path_.c_str());
+        }
+        std::remove(bloom_path_.c_str());
+    }
+
+    // 生成索引时常驻的内存：当前块的 Bloom 过滤器和块边界的写出缓存
+    static size_t MemoryUsage(uint64_t keys_per_block, uint32_t bloom_bits_per_key) {
+        return BloomBytes(std::max<uint64_t>(keys_per_block, 1), bloom_bits_per_key) + INDEX_WRITE_BUFFER;
+    }
+
+    void Add(int64_t key) {
+        if (header_.total_count % header_.keys_per_block == 0) {
+            FlushBlock();
+            block_ = {key, key, header_.total_count * header_.record_size, 0};
+        }
+        block_.max_key = key;
+        ++block_.count;
+        ++header_.total_count;
+
+        if (header_.bloom_hashes > 0) {
+            uint64_t hash = MixKey(key);
+            for (uint32_t i = 0; i < header_.bloom_hashes; ++i) {
+                uint64_t bit = BloomBit(hash, i, header_.bloom_bytes * 8);
+                bloom_[bit / 8] |= static_cast<uint8_t>(1u << (bit % 8));
+            }
+        }
+    }
+
+    // 把 Bloom 过滤器接到块边界后面，再写入完整的文件头
+    bool Finish() {
+        FlushBlock();
+        if (header_.bloom_bytes > 0) {
+            blooms_.close();
+            if (!blooms_) {
+                return false;
+            }
+            std::ifstream input;
+            input.rdbuf()->pubsetbuf(nullptr, 0);
+            input.open(bloom_path_, std::ios::binary);
+            // 当前块的过滤器已经写出，借用它的内存作为复制缓存
+            char* chunk = reinterpret_cast<char*>(bloom_.data());
+            while (input.read(chunk, bloom_.size()) || input.gcount() > 0) {
+                index_.write(chunk, input.gcount());
+            }
+        }
+        index_.seekp(0);
+        index_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+        index_.close();
+        finished_ = static_cast<bool>(index_);
+        return finished_;
+    }
+
+private:
+    static uint64_t BloomBytes(uint64_t keys_per_block, uint32_t bloom_bits_per_key) {
+        return (keys_per_block * bloom_bits_per_key + 7) / 8;
+    }
+
+    void FlushBlock() {
+        if (block_.count == 0) {
+            return;
+        }
+        index_.write(reinterpret_cast<const char*>(&block_), sizeof(block_));
+        if (header_.bloom_bytes > 0) {
+            blooms_.write(reinterpret_cast<const char*>(bloom_.data()), bloom_.size());
+            std::fill(bloom_.begin(), bloom_.end(), 0);
+        }
+        ++header_.block_count;
+        block_.count = 0;
+    }
+
+    std::string index_path_;
+    std::string bloom_path_;
+    IndexHeader header_;
+    IndexBlock block_ = {0, 0, 0, 0}; // 当前块，count 为 0 表示还没有开始
+    std::vector<uint8_t> bloom_; // 当前块的 Bloom 过滤器
+    char buffer_[INDEX_WRITE_BUFFER];
+    std::ofstream index_;
+    std::ofstream blooms_;
+    bool finished_ = false;
+};
+
+// 查询库：加载索引后，点查先用块的键范围和 Bloom 过滤器排除，再用一次 pread 读取整块；
+// 范围查询一次读取所有相关的连续块
+class SortedIndex {
+public:
+    SortedIndex() = default;
+    SortedIndex(const SortedIndex&) = delete;
+    SortedIndex& operator=(const SortedIndex&) = delete;
+
+    ~SortedIndex() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool Open(const std::string& data_path) {
+        std::ifstream input(data_path + INDEX_SUFFIX, std::ios::binary);
+        if (!input.read(reinterpret_cast<char*>(&header_), sizeof(header_)) ||
+            std::memcmp(header_.magic, INDEX_MAGIC, sizeof(header_.magic)) != 0 ||
+            header_.record_size < sizeof(int64_t)) {
+            return false;
+        }
+        blocks_.resize(header_.block_count);
+        blooms_.resize(header_.block_count * header_.bloom_bytes);
+        if (!input.read(reinterpret_cast<char*>(blocks_.data()), blocks_.size() * sizeof(IndexBlock)) ||
+            !input.read(reinterpret_cast<char*>(blooms_.data()), blooms_.size())) {
+            return false;
+        }
+        fd_ = ::open(data_path.c_str(), O_RDONLY);
+        // 数据文件的长度与索引记录的不符时，索引是另一次排序留下的
+        struct stat st;
+        if (fd_ < 0 || ::fstat(fd_, &st) != 0 ||
+            static_cast<uint64_t>(st.st_size) != header_.total_count * header_.record_size) {
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t TotalCount() const { return header_.total_count; }
+    uint32_t RecordSize() const { return header_.record_size; }
+
+    // 点查，计数模式的文件通过 count 返回该键的计数，其他文件返回 1
+    bool Find(int64_t key, uint64_t* count = nullptr) {
+        size_t first = FirstBlock(key);
+        if (first == blocks_.size() || blocks_[first].min_key > key || !MayContain(first, key)) {
+            return false;
+        }
+        std::vector<char> data;
+        if (!ReadBlocks(first, first + 1, data)) {
+            return false;
+        }
+        size_t n = blocks_[first].count;
+        size_t lo = 0;
+        size_t hi = n;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (KeyAt(data, mid) < key) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == n || KeyAt(data, lo) != key) {
+            return false;
+        }
+        if (count) {
+            *count = 1;
+            if (header_.record_size >= sizeof(int64_t) + sizeof(uint64_t)) {
+                std::memcpy(count, data.data() + lo * header_.record_size + sizeof(int64_t), sizeof(uint64_t));
+            }
+        }
+        return true;
+    }
+
+    // 范围查询 [lo, hi]，把命中的键追加到 keys，返回命中个数
+    size_t Range(int64_t lo, int64_t hi, std::vector<int64_t>& keys) {
+        size_t first = FirstBlock(lo);
+        size_t last = first;
+        while (last < blocks_.size() && blocks_[last].min_key <= hi) {
+            ++last;
+        }
+        std::vector<char> data;
+        if (first == last || !ReadBlocks(first, last, data)) {
+            return 0;
+        }
+        size_t found = 0;
+        size_t n = data.size() / header_.record_size;
+        for (size_t i = 0; i < n; ++i) {
+            int64_t key = KeyAt(data, i);
+            if (key >= lo && key <= hi) {
+                keys.push_back(key);
+                ++found;
+            }
+        }
+        return found;
+    }
+
+private:
+    IndexHeader header_{};
+    std::vector<IndexBlock> blocks_;
+    std::vector<uint8_t> blooms_;
+    int fd_ = -1;
+
+    // 第一个最大键不小于 key 的块
+    size_t FirstBlock(int64_t key) const {
+        auto it = std::lower_bound(blocks_.begin(), blocks_.end(), key,
+                                   [](const IndexBlock& block, int64_t k) { return block.max_key < k; });
+        return it - blocks_.begin();
+    }
+
+    bool MayContain(size_t block, int64_t key) const {
+        if (header_.bloom_hashes == 0) {
+            return true;
+        }
+        const uint8_t* bloom = blooms_.data() + block * header_.bloom_bytes;
+        uint64_t hash = MixKey(key);
+        for (uint32_t i = 0; i < header_.bloom_hashes; ++i) {
+            uint64_t bit = BloomBit(hash, i, header_.bloom_bytes * 8);
+            if (!(bloom[bit / 8] & (1u << (bit % 8)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 一次 pread 读取 [first, last) 之间的连续块
+    bool ReadBlocks(size_t first, size_t last, std::vector<char>& data) {
+        uint64_t offset = blocks_[first].offset;
+        uint64_t end = blocks_[last - 1].offset + blocks_[last - 1].count * header_.record_size;
+        data.resize(end - offset);
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = ::pread(fd_, data.data() + done, data.size() - done, offset + done);
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    int64_t KeyAt(const std::vector<char>& data, size_t i) const {
+        int64_t key;
+        std::memcpy(&key, data.data() + i * header_.record_size, sizeof(key));
+        return key;
+    }
+};
+
+#endif // SORTED_INDEX_H
@@ -0,0 +1,276 @@
+#ifndef STRING_KEYS_H
+#define STRING_KEYS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// 变长字符串键的排序库，按字节序（memcmp 的顺序，短的前缀排在前面）排序。
+// 每个键表示为 16 字节的 StringRef：8 字节的规范化前缀，加上键在字节区中的偏移和长度。
+// 规范化前缀是从某个深度开始的 8 个字节按大端序拼成的无符号整数，不足 8 字节时补零，
+// 因此前缀的整数比较与字节序比较一致，大多数比较和基数排序的分桶只需要看前缀，
+// 只有前缀相同时才用 memcmp 比较后面的字节和长度。
+
+struct StringRef {
+    uint64_t prefix;  // 从当前深度开始的 8 个字节
+    uint32_t offset;  // 键在字节区中的偏移
+    uint32_t length;  // 键的字节数
+};
+
+const size_t STRING_PREFIX_BYTES = sizeof(uint64_t);
+const size_t STRING_RADIX_THRESHOLD = 64; // 少于这么多个键时直接比较排序
+const size_t STRING_PREFETCH_DISTANCE = 16; // 重新取前缀时预取后面第几个键
+const uint32_t MAX_STRING_LENGTH = UINT32_MAX; // 长度字段是 uint32
+
+// data 的第 depth 字节开始的规范化前缀，键不到 depth 字节时为 0
+inline uint64_t NormalizedPrefix(const char* data, size_t length, size_t depth = 0) {
+    uint64_t prefix = 0;
+    if (length > depth) {
+        std::memcpy(&prefix, data + depth, std::min(length - depth, STRING_PREFIX_BYTES));
+    }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    prefix = __builtin_bswap64(prefix);
+#endif
+    return prefix;
+}
+
+// 前 skip 个字节已知相同时比较两个键，返回值的符号与 memcmp 相同
+inline int CompareFrom(const char* a, size_t a_length, const char* b, size_t b_length, size_t skip) {
+    size_t common = std::min(a_length, b_length);
+    if (common > skip) {
+        int result = std::memcmp(a + skip, b + skip, common - skip);
+        if (result != 0) {
+            return result;
+        }
+    }
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+// 比较同一深度的两个 StringRef：前缀不同时直接得出结果，相同时比较前缀之后的字节
+class StringLess {
+public:
+    StringLess(const char* arena, size_t depth, uint64_t* tie_compares)
+        : arena_(arena), skip_(depth + STRING_PREFIX_BYTES), tie_compares_(tie_compares) {}
+
+    bool operator()(const StringRef& a, const StringRef& b) const {
+        if (a.prefix != b.prefix) {
+            return a.prefix < b.prefix;
+        }
+        ++*tie_compares_;
+        return CompareFrom(arena_ + a.offset, a.length, arena_ + b.offset, b.length, skip_) < 0;
+    }
+
+private:
+    const char* arena_;
+    size_t skip_;
+    uint64_t* tie_compares_;
+};
+
+// MSD 基数排序：按前缀从高到低逐字节分桶，桶小于阈值时改用比较排序。
+// 一个桶用完前缀的 8 个字节后，从下一个深度重新取前缀继续分桶，
+// 所以公共前缀很长的键（如同一个网站的 URL）也主要在整数上排序
+class StringRadixSorter {
+public:
+    explicit StringRadixSorter(const char* arena) : arena_(arena) {}
+
+    // refs 中的前缀必须是深度 0 的前缀；scratch 至少与 refs 一样大。排序后 refs 中的前缀不再有意义
+    void Sort(StringRef* refs, size_t count, StringRef* scratch) { SortLevel(refs, count, scratch, 0, 0); }
+
+    uint64_t Passes() const { return passes_; }
+    uint64_t TieCompares() const { return tie_compares_; }
+
+private:
+    const char* arena_;
+    uint64_t passes_ = 0;       // 分桶时搬动数据的次数
+    uint64_t tie_compares_ = 0; // 前缀相同、需要比较后续字节的次数
+
+    // 一组待排序的键：它们的前 depth 字节都相同，前缀中的前 byte 个字节也都相同
+    struct Group {
+        StringRef* refs;
+        StringRef* scratch;
+        size_t count;
+        size_t depth;
+        size_t byte;
+    };
+
+    // 长度相差很大的长键每个深度都可能分出新的桶，用显式的栈代替递归，避免栈溢出
+    void SortLevel(StringRef* refs, size_t count, StringRef* scratch, size_t depth, size_t byte) {
+        std::vector<Group> pending = {{refs, scratch, count, depth, byte}};
+        while (!pending.empty()) {
+            Group group = pending.back();
+            pending.pop_back();
+            SortGroup(group, pending);
+        }
+    }
+
+    // 排序一组键，分出的桶放进 pending
+    void SortGroup(Group group, std::vector<Group>& pending) {
+        StringRef* refs = group.refs;
+        size_t count = group.count;
+        while (count >= STRING_RADIX_THRESHOLD) {
+            if (group.byte == STRING_PREFIX_BYTES) {
+                // 前缀用完了，不比新深度更长的键都已经没有更多字节，它们之间只按长度排序
+                group.depth += STRING_PREFIX_BYTES;
+                uint32_t longest = 0;
+                for (size_t i = 0; i < count; ++i) {
+                    // 分桶之后键在字节区中的位置是乱序的，提前取后面的键，把缓存缺失重叠起来
+                    if (i + STRING_PREFETCH_DISTANCE < count) {
+                        __builtin_prefetch(arena_ + refs[i + STRING_PREFETCH_DISTANCE].offset + group.depth);
+                    }
+                    refs[i].prefix = NormalizedPrefix(arena_ + refs[i].offset, refs[i].length, group.depth);
+                    longest = std::max(longest, refs[i].length);
+                }
+                if (longest <= group.depth) {
+                    std::sort(refs, refs + count,
+                              [](const StringRef& a, const StringRef& b) { return a.length < b.length; });
+                    return;
+                }
+                group.byte = 0;
+            }
+
+            // 所有键都相同的字节（URL 的 "https://" 等）不需要分桶，一次扫描跳过前缀中的公共部分
+            uint64_t differ = 0;
+            for (size_t i = 1; i < count; ++i) {
+                differ |= refs[i].prefix ^ refs[0].prefix;
+            }
+            if (differ == 0) {
+                group.byte = STRING_PREFIX_BYTES;
+                continue;
+            }
+            group.byte = std::max<size_t>(group.byte, __builtin_clzll(differ) / 8);
+
+            int shift = 56 - 8 * static_cast<int>(group.byte);
+            size_t counts[256] = {0};
+            for (size_t i = 0; i < count; ++i) {
+                ++counts[(refs[i].prefix >> shift) & 0xFF];
+            }
+
+            size_t starts[256];
+            size_t start = 0;
+            for (int b = 0; b < 256; ++b) {
+                starts[b] = start;
+                start += counts[b];
+            }
+            for (size_t i = 0; i < count; ++i) {
+                group.scratch[starts[(refs[i].prefix >> shift) & 0xFF]++] = refs[i];
+            }
+            std::memcpy(refs, group.scratch, count * sizeof(StringRef));
+            ++passes_;
+
+            start = 0;
+            for (int b = 0; b < 256; ++b) {
+                if (counts[b] > 1) {
+                    pending.push_back({refs + start, group.scratch + start, counts[b], group.depth, group.byte + 1});
+                }
+                start += counts[b];
+            }
+            return;
+        }
+        std::sort(refs, refs + count, StringLess(arena_, group.depth, &tie_compares_));
+    }
+};
+
+// 一块连续内存：键的字节从前往后放，StringRef 从后往前放，排序用的临时数组在排序时放在两者之间，
+// 因此键的长短不同也不会浪费内存。最后一个键可以分几次追加（跨越读取缓存的长行）
+class StringBlock {
+public:
+    explicit StringBlock(size_t capacity)
+        : capacity_(std::min<size_t>(capacity, MAX_STRING_LENGTH) / alignof(StringRef) * alignof(StringRef)),
+          memory_(new char[capacity_]) {}
+
+    // 追加到正在写入的键，空间不足时返回 false 且不写入
+    bool Append(const char* data, size_t size) {
+        size_t refs_bytes = (count_ + 1) * sizeof(StringRef);
+        size_t arena_end = AlignUp(arena_used_ + size);
+        if (arena_end + 2 * refs_bytes > capacity_) {
+            return false;
+        }
+        std::memcpy(memory_.get() + arena_used_, data, size);
+        arena_used_ += size;
+        return true;
+    }
+
+    // 结束正在写入的键并为它建立 StringRef
+    bool EndRecord() {
+        size_t length = arena_used_ - open_start_;
+        if (AlignUp(arena_used_) + 2 * (count_ + 1) * sizeof(StringRef) > capacity_) {
+            return false;
+        }
+        ++count_;
+        StringRef& ref = Refs()[0];
+        ref.offset = static_cast<uint32_t>(open_start_);
+        ref.length = static_cast<uint32_t>(length);
+        ref.prefix = NormalizedPrefix(memory_.get() + open_start_, length);
+        open_start_ = arena_used_;
+        return true;
+    }
+
+    // 丢弃已经结束的键，正在写入的键移到开头
+    void Clear() {
+        size_t open = arena_used_ - open_start_;
+        std::memmove(memory_.get(), memory_.get() + open_start_, open);
+        arena_used_ = open;
+        open_start_ = 0;
+        count_ = 0;
+    }
+
+    size_t Count() const { return count_; }
+    const char* Arena() const { return memory_.get(); }
+    size_t Capacity() const { return capacity_; }
+
+    // 按读入的逆序排列，排序后即为有序
+    StringRef* Refs() { return reinterpret_cast<StringRef*>(memory_.get() + capacity_) - count_; }
+
+    // 位于字节区之后，大小与 Refs() 相同
+    StringRef* Scratch() { return reinterpret_cast<StringRef*>(memory_.get() + AlignUp(arena_used_)); }
+
+private:
+    size_t capacity_;
+    std::unique_ptr<char[]> memory_;
+    size_t arena_used_ = 0;
+    size_t open_start_ = 0; // 正在写入的键的起始位置
+    size_t count_ = 0;
+
+    static size_t AlignUp(size_t bytes) {
+        return (bytes + alignof(StringRef) - 1) / alignof(StringRef) * alignof(StringRef);
+    }
+};
+
+// 顺序读取归并段：每条记录是 uint32 长度加上键的字节，读出的键带着它的规范化前缀
+class StringRunReader {
+public:
+    // max_key 是归并段中最长键的字节数，键的缓存预先分配到这么大，读取时不再增长
+    StringRunReader(std::istream& input, size_t max_key) : input_(input) { key_.reserve(max_key); }
+
+    // 读取下一条记录，在记录边界上遇到文件结束时返回 false；记录只读到一部分说明归并段被截断，抛出异常
+    bool Next() {
+        uint32_t length;
+        if (!input_.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+            if (input_.gcount() == 0 && input_.eof()) {
+                return false;
+            }
+            throw std::runtime_error("字符串归并段在记录中间被截断");
+        }
+        key_.resize(length);
+        if (length > 0 && !input_.read(&key_[0], length)) {
+            throw std::runtime_error("字符串归并段在记录中间被截断");
+        }
+        prefix_ = NormalizedPrefix(key_.data(), key_.size());
+        return true;
+    }
+
+    const std::string& Key() const { return key_; }
+    uint64_t Prefix() const { return prefix_; }
+
+private:
+    std::istream& input_;
+    std::string key_;
+    uint64_t prefix_ = 0;
+};
+
+#endif // STRING_KEYS_H
@@ -8,11 +8,426 @@
 #include <cstring>
 #include <mutex>
 #include <stdexcept>
+#include <unordered_set>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <cctype>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/mempolicy.h>
+#include "sorted_index.h"
+#include "verifier.h"
+#include "text_parser.h"
+#include "memory_budget.h"
+#include "block_sort.h"
+#include "disk_simulator.h"
+#include "string_keys.h"
+#include "shuffle_net.h"
 
-const size_t MEMORY_LIMIT = 16 * 1024; // 16KB的内存限制
-const size_t BLOCK_SIZE = MEMORY_LIMIT / sizeof(int64_t); // 每个块的大小，以int64_t为单位
+const size_t MEMORY_LIMIT = 16 * 1024; // 默认预算下数据块的内存，16KB
+const size_t BLOCK_SIZE = MEMORY_LIMIT / sizeof(int64_t); // 默认预算下每个块的大小，以int64_t为单位
 const size_t CACHE_SIZE = 8 * 1024; // 8KB的缓存大小
-const size_t MERGE_BATCH_SIZE = 8; // 每次合并的文件数
+const size_t MERGE_BATCH_SIZE = 8; // 默认预算下每次合并的文件数
+const size_t DEFAULT_MEMORY_BUDGET = MEMORY_LIMIT + CACHE_SIZE; // 没有 --memory 和 cgroup 限制时的预算：一个数据块加上写出缓存
+const size_t MIN_BLOCK_KEYS = 256; // 内存紧张时数据块最少的键数
+const size_t MIN_MEMORY_BUDGET = 2 * CACHE_SIZE + MIN_BLOCK_KEYS * sizeof(int64_t); // 写出缓存、文本读取缓存和最小的数据块
+const size_t READ_STEP_KEYS = 64 * 1024; // 大数据块分几次读入，每次读入后检查内存压力
+const size_t MERGE_STREAM_BUFFER = MEMORY_LIMIT / MERGE_BATCH_SIZE; // 归并时每个输入流的缓存，默认预算下正好归并 8 路
+const size_t MAX_MERGE_FAN_IN = 256; // 归并路数的上限
+const size_t MAX_BUCKETS = 256; // 分布排序一次拆分的最多桶数，每个桶同时打开一个文件
+const size_t MIN_WC_KEYS = 8; // 每个桶的写合并缓存至少一个缓存行（64 字节）
+const size_t MAX_WC_KEYS = 512; // 写合并缓存最多 4KB，攒够一页再写
+const size_t SAMPLES_PER_BUCKET = 32; // 确定分割点时每个桶的抽样数
+const size_t MAX_BUCKET_WORKERS = 8; // 并行排序桶的最多线程数
+const size_t MAX_PARTITION_WORKERS = 8; // 同时归并的最多分区数
+const char* const PARTS_SUFFIX = ".parts"; // 分区输出的清单
+const size_t MAX_DIST_WORKERS = 64; // 分布式排序最多的工作进程数
+const int DIST_CONNECT_WAIT_MS = 60000; // 等待其他工作进程开始监听的最长时间，多台机器上的进程启动的先后不定
+const size_t DIST_SAMPLES = 1024; // 每个工作进程抽取的样本数，建立连接时随握手一起发出，不会填满套接字缓存
+const size_t DIST_BATCH_BYTES = 64 * 1024; // 洗牌时每批读取和发送的最大字节数
+const size_t RUN_SCAN_CHUNK = 64; // 有序性预扫描每次检查的元素数，便于编译器向量化
+
+// 数据块的自然有序性
+enum class RunOrder {
+    kAscending,  // 非递减
+    kDescending, // 非递增
+    kUnsorted    // 无序
+};
+
+// 预扫描数据块，判断是否已经升序或降序
+// 内层循环无分支，编译器可以将其向量化；每个分段检查完后一旦两个方向都出现逆序就提前退出
+RunOrder DetectRunOrder(const int64_t* data, size_t count) {
+    size_t ascending_breaks = 0;
+    size_t descending_breaks = 0;
+    for (size_t i = 1; i < count; i += RUN_SCAN_CHUNK) {
+        size_t chunk_end = std::min(i + RUN_SCAN_CHUNK, count);
+        for (size_t j = i; j < chunk_end; ++j) {
+            ascending_breaks += data[j - 1] > data[j];
+            descending_breaks += data[j - 1] < data[j];
+        }
+        if (ascending_breaks != 0 && descending_breaks != 0) {
+            return RunOrder::kUnsorted;
+        }
+    }
+    if (ascending_breaks == 0) {
+        return RunOrder::kAscending;
+    }
+    return descending_breaks == 0 ? RunOrder::kDescending : RunOrder::kUnsorted;
+}
+
+// 重复键的聚合方式
+enum class AggregateMode {
+    kNone,     // 保留所有重复键
+    kDistinct, // 只保留不同的键
+    kCount     // 输出 (键, uint64 计数) 记录
+};
+
+// 排序引擎
+enum class SortEngine {
+    kAuto,   // 由规划器根据输入和选项选择
+    kMerge,  // 生成归并段后多路归并
+    kBucket  // 按抽样分割点分桶后逐桶排序
+};
+
+// 闭区间 [first, second] 表示的键范围
+using KeyRange = std::pair<int64_t, int64_t>;
+
+// 将键范围排序并合并重叠或相邻的部分，得到互不相交的有序范围列表
+void NormalizeRanges(std::vector<KeyRange>& ranges) {
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<KeyRange> merged;
+    for (const auto& range : ranges) {
+        if (!merged.empty() && (merged.back().second == INT64_MAX || range.first <= merged.back().second + 1)) {
+            merged.back().second = std::max(merged.back().second, range.second);
+        } else {
+            merged.push_back(range);
+        }
+    }
+    ranges = std::move(merged);
+}
+
+// 排序选项
+struct SortOptions {
+    AggregateMode mode = AggregateMode::kNone; // 重复键的聚合方式
+    size_t limit = 0; // 只输出最前面的 limit 个键，0 表示全部输出
+    bool descending = false; // 按降序输出，与 limit 一起用于求最大的 N 个键
+    std::vector<KeyRange> ranges; // 只保留落在这些范围内的键，为空表示不过滤
+    bool incremental = false; // 把已有的输出文件当作一个归并段，只排序新输入再合并一次
+    std::string job_id; // 非空时在 temp_sort/<job_id>/ 下记录清单，中断后用同一个任务 ID 可以继续
+    bool build_index = true; // 在最终归并时生成 .idx 稀疏索引，降序输出不生成
+    size_t index_every = 512; // 索引中每块的记录数
+    uint32_t bloom_bits = 0; // 每个键在块 Bloom 过滤器中占用的比特数，0 表示不生成过滤器
+    bool text_input = false; // 输入文件是十进制文本而不是 int64 二进制
+    size_t text_column = 0; // 文本输入取第几列（从 1 开始），0 表示每行就是一个整数
+    char delimiter = ','; // 文本输入的列分隔符
+    SortEngine engine = SortEngine::kAuto; // 排序引擎
+    size_t memory_limit = 0; // 内存预算（字节），0 表示取 cgroup 限制的一半，没有限制时使用默认预算
+    bool numa = false; // 每个 NUMA 节点一个绑定的工作线程生成归并段，单节点机器上不生效
+    bool strings = false; // 输入和输出都是按行分隔的字符串，按字节序排序
+    size_t partitions = 0; // 大于 0 时按键范围输出到这么多个文件，并写出分区清单
+    std::vector<int64_t> splitters; // 分区 i 含有 [splitters[i-1], splitters[i]) 中的键，为空时按记录数均分
+};
+
+// 排序统计信息
+struct SortStats {
+    size_t presorted_files = 0; // 读入时整体有序的输入文件数，能直接引用的不再写出
+    size_t presorted_blocks = 0; // 已有序、跳过排序的数据块数
+    size_t reversed_blocks = 0; // 降序、只需反转的数据块数
+    size_t sorted_blocks = 0; // 需要完整排序的数据块数
+    size_t collapsed_duplicates = 0; // 在排序和归并中合并掉的重复记录数
+    size_t scanned_keys = 0; // 从输入读取的键数
+    size_t kept_keys = 0; // 通过范围过滤的键数
+    size_t resumed_inputs = 0; // 从清单恢复、跳过的输入文件数
+    size_t resumed_runs = 0; // 从清单恢复的归并段数
+    size_t block_resizes = 0; // 按预算和内存压力调整数据块大小的次数
+    bool bucket_engine = false; // 是否使用了分布排序
+    size_t buckets_sorted = 0; // 分布排序中在内存里排序的桶数
+    size_t uniform_buckets = 0; // 所有键都相同、直接写出的桶数
+    size_t bucket_splits = 0; // 超过容量再次拆分的桶数
+    uint64_t io_read_bytes = 0; // 分布排序读取的字节数（输入、抽样和桶文件）
+    uint64_t io_write_bytes = 0; // 分布排序写入的字节数（桶文件和输出）
+    size_t numa_nodes = 0; // 实际使用的 NUMA 节点数
+    size_t numa_local_pages = 0; // 抽样检查的数据块、缓存页面中位于本节点的页数
+    size_t numa_remote_pages = 0; // 位于其他节点的页数
+    size_t partition_workers = 0; // 同时归并的分区数
+
+    void Add(const SortStats& other) {
+        presorted_files += other.presorted_files;
+        presorted_blocks += other.presorted_blocks;
+        reversed_blocks += other.reversed_blocks;
+        sorted_blocks += other.sorted_blocks;
+        collapsed_duplicates += other.collapsed_duplicates;
+        scanned_keys += other.scanned_keys;
+        kept_keys += other.kept_keys;
+        resumed_inputs += other.resumed_inputs;
+        resumed_runs += other.resumed_runs;
+        block_resizes += other.block_resizes;
+        bucket_engine = bucket_engine || other.bucket_engine;
+        buckets_sorted += other.buckets_sorted;
+        uniform_buckets += other.uniform_buckets;
+        bucket_splits += other.bucket_splits;
+        io_read_bytes += other.io_read_bytes;
+        io_write_bytes += other.io_write_bytes;
+        numa_local_pages += other.numa_local_pages;
+        numa_remote_pages += other.numa_remote_pages;
+    }
+};
+
+const uint64_t CHECKSUM_SEED = 0xcbf29ce484222325ULL;
+
+// 按 8 字节字累加校验和，所有归并段的长度都是 8 字节的整数倍
+uint64_t UpdateChecksum(uint64_t checksum, const char* data, size_t size) {
+    for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        checksum = (checksum ^ word) * 0x100000001b3ULL;
+        checksum ^= checksum >> 29;
+    }
+    return checksum;
+}
+
+// 打开不带内部缓存的文件流，读写都经过排序程序自己在预算中登记过的缓存
+template <typename Stream>
+void OpenUnbuffered(Stream& stream, const std::string& path, std::ios::openmode mode = std::ios::openmode()) {
+    stream.rdbuf()->pubsetbuf(nullptr, 0);
+    stream.open(path, mode | std::ios::binary);
+}
+
+// 调用者负责在预算中登记 CACHE_SIZE 字节的读取缓存
+uint64_t ChecksumFile(const std::string& path) {
+    DiskInputFile input;
+    OpenUnbuffered(input, path);
+    std::vector<char> chunk(CACHE_SIZE);
+    uint64_t checksum = CHECKSUM_SEED;
+    while (input.read(chunk.data(), chunk.size()) || input.gcount() > 0) {
+        checksum = UpdateChecksum(checksum, chunk.data(), input.gcount());
+    }
+    return checksum;
+}
+
+// 将文件（或目录项）刷到磁盘，保证记录进清单的内容在断电后仍然存在
+void SyncPath(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+// 归并段清单：按行追加记录已完成的归并段、已读完的输入文件和已完成的归并步骤，
+// 字段之间用制表符分隔。中断后重新读取清单即可得到当前仍然有效的归并段。
+//   job    <任务指纹>                          （第一行：排序选项、记录大小和输入文件列表）
+//   run    <路径> <字节数> <校验和>
+//   input  <输入文件> <键数> <哈希和> <哈希异或> <文件字节数> <修改时间> （之前的 run 行都来自这个输入文件）
+//   merge  <输出> <字节数> <校验和> <输入...>  （输入已被这次归并消耗）
+//   done                                      （最终结果已经写到输出文件）
+class RunManifest {
+public:
+    struct RunInfo {
+        std::string path;
+        uintmax_t size = 0;
+        uint64_t checksum = 0;
+    };
+
+    // 已经读完的输入文件在读取时的大小和修改时间，继续任务前确认它没有被修改过
+    struct InputInfo {
+        uintmax_t size = 0;
+        int64_t mtime = 0;
+    };
+
+    explicit RunManifest(const std::string& job_dir) : job_dir_(job_dir), path_(job_dir + "/manifest.txt") {}
+
+    ~RunManifest() {
+        if (file_) {
+            std::fclose(file_);
+        }
+    }
+
+    RunManifest(const RunManifest&) = delete;
+    RunManifest& operator=(const RunManifest&) = delete;
+
+    // 读取已有的清单，返回 false 表示没有可恢复的进度
+    bool Load() {
+        std::ifstream input(path_);
+        if (!input.is_open()) {
+            return false;
+        }
+
+        std::vector<RunInfo> pending; // 所属输入文件尚未读完的归并段，中断后作废
+        std::string line;
+        bool has_records = false;
+        while (std::getline(input, line)) {
+            if (input.eof()) {
+                break; // 最后一行没有换行符，说明写到一半时中断了
+            }
+            std::vector<std::string> fields = SplitFields(line);
+            if (fields[0] == "job" && fields.size() == 2) {
+                fingerprint_ = fields[1];
+            } else if (fields[0] == "run" && fields.size() == 4) {
+                pending.push_back(ParseRun(fields));
+            } else if (fields[0] == "input" && fields.size() == 7) {
+                live_runs_.insert(live_runs_.end(), pending.begin(), pending.end());
+                pending.clear();
+                InputInfo info;
+                info.size = std::stoull(fields[5]);
+                info.mtime = std::stoll(fields[6]);
+                done_inputs_[fields[1]] = info;
+                MultisetHash hash;
+                hash.count = std::stoull(fields[2]);
+                hash.sum = std::stoull(fields[3]);
+                hash.xor_sum = std::stoull(fields[4]);
+                input_hash_.Merge(hash);
+            } else if (fields[0] == "merge" && fields.size() >= 5) {
+                std::unordered_set<std::string> inputs(fields.begin() + 4, fields.end());
+                live_runs_.erase(std::remove_if(live_runs_.begin(), live_runs_.end(),
+                                                [&](const RunInfo& run) { return inputs.count(run.path); }),
+                                 live_runs_.end());
+                consumed_.insert(inputs.begin(), inputs.end());
+                live_runs_.push_back(ParseRun(fields));
+            } else if (fields[0] == "done") {
+                done_ = true;
+            } else {
+                continue;
+            }
+            has_records = true;
+        }
+        return has_records;
+    }
+
+    // 清空进度，删除任务目录下的所有文件
+    void Reset() {
+        if (file_) {
+            std::fclose(file_);
+            file_ = nullptr;
+        }
+        std::filesystem::remove_all(job_dir_);
+        std::filesystem::create_directories(job_dir_);
+        live_runs_.clear();
+        done_inputs_.clear();
+        consumed_.clear();
+        input_hash_ = MultisetHash();
+        fingerprint_.clear();
+        done_ = false;
+    }
+
+    // 新任务的第一条记录
+    void RecordJob(const std::string& fingerprint) {
+        fingerprint_ = fingerprint;
+        Append("job\t" + fingerprint + "\n");
+    }
+
+    // 一个输入文件全部处理完后，把它产生的归并段、读入的键的哈希和它本身一起记录下来
+    void RecordInput(const std::string& input_file, const std::vector<RunInfo>& runs, const MultisetHash& hash) {
+        std::string lines;
+        for (const auto& run : runs) {
+            lines += "run\t" + FormatRun(run) + "\n";
+        }
+        InputInfo info = StatInput(input_file);
+        lines += "input\t" + input_file + "\t" + std::to_string(hash.count) + "\t" + std::to_string(hash.sum) +
+                 "\t" + std::to_string(hash.xor_sum) + "\t" + std::to_string(info.size) + "\t" +
+                 std::to_string(info.mtime) + "\n";
+        Append(lines);
+    }
+
+    void RecordMerge(const RunInfo& merged, const std::vector<std::string>& inputs) {
+        std::string line = "merge\t" + FormatRun(merged);
+        for (const auto& input : inputs) {
+            line += "\t" + input;
+        }
+        Append(line + "\n");
+    }
+
+    // 最终结果已经发布：先记录 done，再删除整个任务目录，之后用同一个任务 ID 会重新开始。
+    // 删除之前中断时，下次看到 done 会再删一次
+    void Finish() {
+        Append("done\n");
+        std::fclose(file_);
+        file_ = nullptr;
+        std::filesystem::remove_all(job_dir_);
+    }
+
+    // 输入文件现在的大小和修改时间，文件不存在时都为 0
+    static InputInfo StatInput(const std::string& input_file) {
+        InputInfo info;
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(input_file, ec);
+        info.size = ec ? 0 : size;
+        auto mtime = std::filesystem::last_write_time(input_file, ec);
+        info.mtime = ec ? 0 : static_cast<int64_t>(mtime.time_since_epoch().count());
+        return info;
+    }
+
+    bool IsInputDone(const std::string& input_file) const { return done_inputs_.count(input_file) > 0; }
+    const std::unordered_map<std::string, InputInfo>& DoneInputs() const { return done_inputs_; }
+    const std::string& Fingerprint() const { return fingerprint_; }
+    bool IsConsumed(const std::string& run) const { return consumed_.count(run) > 0; }
+    bool IsDone() const { return done_; }
+    const MultisetHash& InputHash() const { return input_hash_; }
+    const std::vector<RunInfo>& LiveRuns() const { return live_runs_; }
+    const std::string& GetPath() const { return path_; }
+
+private:
+    std::string job_dir_;
+    std::string path_;
+    FILE* file_ = nullptr;
+    std::vector<RunInfo> live_runs_;
+    std::unordered_map<std::string, InputInfo> done_inputs_;
+    std::string fingerprint_;
+    std::unordered_set<std::string> consumed_;
+    MultisetHash input_hash_; // 已经处理完的输入文件的键哈希之和
+    bool done_ = false;
+
+    // 追加记录并立即刷盘，记录落盘之后才能删除被它取代的文件
+    void Append(const std::string& lines) {
+        if (!file_) {
+            file_ = std::fopen(path_.c_str(), "a");
+            if (!file_) {
+                throw std::runtime_error("无法打开清单文件: " + path_);
+            }
+        }
+        std::fputs(lines.c_str(), file_);
+        std::fflush(file_);
+        ::fsync(::fileno(file_));
+        SyncPath(job_dir_);
+    }
+
+    static std::vector<std::string> SplitFields(const std::string& line) {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        while (true) {
+            size_t tab = line.find('\t', start);
+            fields.push_back(line.substr(start, tab - start));
+            if (tab == std::string::npos) {
+                return fields;
+            }
+            start = tab + 1;
+        }
+    }
+
+    static std::string FormatRun(const RunInfo& run) {
+        return run.path + "\t" + std::to_string(run.size) + "\t" + std::to_string(run.checksum);
+    }
+
+    static RunInfo ParseRun(const std::vector<std::string>& fields) {
+        RunInfo run;
+        run.path = fields[1];
+        run.size = std::stoull(fields[2]);
+        run.checksum = std::stoull(fields[3]);
+        return run;
+    }
+};
 
 // 缓存类
 class Buffer {
@@ -29,11 +444,10 @@ public:
         }
     }
 
+    // 空间不足时返回 false，由调用方先把缓存写出；缓存不会自行扩大，否则会超出内存预算
     bool Write(const void* data, size_t size) {
         if (write_pos_ + size > size_) {
-            if (!ExpandBuffer()) {
-                throw std::runtime_error("Buffer expansion failed");
-            }
+            return false;
         }
         std::memcpy(buffer_ + write_pos_, data, size);
         write_pos_ += size;
@@ -63,196 +477,3071 @@ private:
     size_t write_pos_;
     size_t read_pos_;
     bool should_delete_; // 控制是否释放内存
+};
+
+// NUMA 节点及其 CPU
+struct NumaNode {
+    int id = 0;
+    std::vector<int> cpus;
+};
 
-    bool ExpandBuffer() {
-        size_t new_size = size_ * 2;
-        char* new_buffer = new char[new_size];
-        if (!new_buffer) {
-            return false; // 内存分配失败
+// 从 sysfs 读取 NUMA 拓扑，只返回带有 CPU 的节点
+std::vector<NumaNode> DetectNumaNodes() {
+    std::vector<NumaNode> nodes;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("node", 0) != 0 || name.size() == 4 || !std::isdigit(static_cast<unsigned char>(name[4]))) {
+            continue;
         }
-        std::memcpy(new_buffer, buffer_, size_);
-        if (should_delete_) {
-            delete[] buffer_; // 确保原有内存只被释放一次
+        NumaNode node;
+        node.id = std::stoi(name.substr(4));
+
+        // cpulist 的格式如 0-3,8-11
+        std::ifstream cpulist(entry.path() / "cpulist");
+        std::string list;
+        std::getline(cpulist, list);
+        size_t pos = 0;
+        while (pos < list.size()) {
+            size_t comma = std::min(list.find(',', pos), list.size());
+            std::string part = list.substr(pos, comma - pos);
+            if (!part.empty() && std::isdigit(static_cast<unsigned char>(part[0]))) {
+                size_t dash = part.find('-');
+                int first = std::stoi(part.substr(0, dash));
+                int last = dash == std::string::npos ? first : std::stoi(part.substr(dash + 1));
+                for (int cpu = first; cpu <= last; ++cpu) {
+                    node.cpus.push_back(cpu);
+                }
+            }
+            pos = comma + 1;
         }
-        buffer_ = new_buffer;
-        size_ = new_size;
-        should_delete_ = true;
-        return true;
+        if (!node.cpus.empty()) {
+            nodes.push_back(node);
+        }
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+    return nodes;
+}
+
+// 把当前线程绑定到节点的 CPU 上，并让之后的内存分配优先落在这个节点
+void BindToNumaNode(const NumaNode& node) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : node.cpus) {
+        CPU_SET(cpu, &cpus);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    const size_t bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(node.id / bits + 1, 0);
+    mask[node.id / bits] |= 1UL << (node.id % bits);
+    ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * bits + 1);
+}
+
+// 按页抽样检查一段已经写过的内存位于哪个节点，累计本地和远端页数
+void CountPagePlacement(const void* data, size_t size, int node, SortStats& stats) {
+    const size_t page_size = 4096;
+    const size_t max_samples = 64;
+    size_t step = std::max(page_size, size / max_samples / page_size * page_size);
+    const char* base = static_cast<const char*>(data);
+    for (size_t offset = 0; offset < size; offset += step) {
+        int page_node = -1;
+        if (::syscall(SYS_get_mempolicy, &page_node, nullptr, 0, base + offset, MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+            return;
+        }
+        if (page_node == node) {
+            ++stats.numa_local_pages;
+        } else {
+            ++stats.numa_remote_pages;
+        }
+    }
+}
+
+// 输入文件中键的来源：二进制文件直接读入数据块，文本文件解析后写入数据块
+class KeySource {
+public:
+    KeySource(const std::string& path, const SortOptions& options, MemoryBudget& memory) {
+        OpenUnbuffered(input_, path);
+        if (options.text_input) {
+            text_memory_ = std::make_unique<MemoryReservation>(memory, CACHE_SIZE, "文本读取缓存");
+            auto can_grow = [this](size_t bytes) { return text_memory_->Resize(bytes); };
+            text_ = std::make_unique<TextKeyReader>(input_, path, options.text_column, options.delimiter, CACHE_SIZE,
+                                                    can_grow);
+        }
+    }
+
+    bool IsOpen() const { return input_.is_open(); }
+
+    // 读取最多 max_count 个键，返回读到的个数，少于 max_count 表示文件已经读完
+    size_t Read(int64_t* keys, size_t max_count) {
+        if (text_) {
+            return text_->Read(keys, max_count);
+        }
+        input_.read(reinterpret_cast<char*>(keys), max_count * sizeof(int64_t));
+        return input_.gcount() / sizeof(int64_t);
+    }
+
+private:
+    DiskInputFile input_;
+    std::unique_ptr<MemoryReservation> text_memory_;
+    std::unique_ptr<TextKeyReader> text_;
+};
+
+// 无分支的二分查找：返回第一个大于 key 的分割点的下标，也就是 key 所在的桶
+// 循环次数只取决于分割点个数，比较结果用条件传送更新位置，不会因为分支预测失败而停顿
+inline size_t FindBucket(const std::vector<int64_t>& splitters, int64_t key) {
+    size_t length = splitters.size();
+    if (length == 0) {
+        return 0;
+    }
+    const int64_t* base = splitters.data();
+    while (length > 1) {
+        size_t half = length / 2;
+        base += (base[half] <= key) * half;
+        length -= half;
+    }
+    return (base - splitters.data()) + (*base <= key);
+}
+
+// 分布排序中的一个桶：键范围与其他桶互不重叠的一个临时文件
+struct Bucket {
+    std::string path;
+    uint64_t count = 0;
+    int64_t min_key = INT64_MAX;
+    int64_t max_key = INT64_MIN;
+};
+
+// 分布排序的规划
+struct BucketPlan {
+    uint64_t total_keys = 0;
+    size_t workers = 1; // 并行排序桶的线程数
+    size_t bucket_keys = 0; // 一个桶在内存中排序时最多容纳的键数
+    size_t bucket_count = 1; // 第一次拆分的桶数
+    bool two_pass = true; // 第一次拆分后每个桶预计都能放进内存
+};
+
+// 分区输出中的一个文件，键范围为 [lower, upper)
+struct PartitionInfo {
+    std::string path;
+    bool has_lower = false; // 第一个分区没有下界
+    int64_t lower = 0;
+    bool has_upper = false; // 最后一个分区没有上界
+    int64_t upper = 0;
+    uint64_t records = 0;
+    int64_t min_key = 0; // records > 0 时有效
+    int64_t max_key = 0;
+};
+
+// 写出分区清单，每行一个分区，字段之间用制表符分隔：
+//   <文件> <下界（含）> <上界（不含）> <记录数> <最小键> <最大键>
+// 没有下界或上界时写 "-"，分区为空时最小键和最大键也写 "-"
+void WritePartitionManifest(const std::string& path, const std::vector<PartitionInfo>& partitions) {
+    std::ofstream manifest(path + ".tmp", std::ios::trunc);
+    auto bound = [](bool has, int64_t key) { return has ? std::to_string(key) : std::string("-"); };
+    for (const auto& part : partitions) {
+        manifest << std::filesystem::path(part.path).filename().string() << "\t" << bound(part.has_lower, part.lower)
+                 << "\t" << bound(part.has_upper, part.upper) << "\t" << part.records << "\t"
+                 << bound(part.records > 0, part.min_key) << "\t" << bound(part.records > 0, part.max_key) << "\n";
+    }
+    manifest.close();
+    if (!manifest) {
+        throw std::runtime_error("无法写入分区清单: " + path);
     }
+    std::filesystem::rename(path + ".tmp", path);
+}
+
+// 按记录序号用 pread 读取归并段中的键，用于二分查找分区边界
+class RunKeyReader {
+public:
+    RunKeyReader(const std::string& path, size_t record_size)
+        : fd_(::open(path.c_str(), O_RDONLY)), record_size_(record_size), disk_(DiskSimulator::Instance().Find(path)) {
+        if (fd_ < 0) {
+            throw std::runtime_error("无法打开临时文件: " + path);
+        }
+        records_ = std::filesystem::file_size(path) / record_size;
+    }
+
+    RunKeyReader(const RunKeyReader&) = delete;
+    RunKeyReader& operator=(const RunKeyReader&) = delete;
+
+    ~RunKeyReader() { ::close(fd_); }
+
+    uint64_t Records() const { return records_; }
+
+    int64_t Key(uint64_t index) {
+        int64_t key;
+        if (::pread(fd_, &key, sizeof(key), index * record_size_) != static_cast<ssize_t>(sizeof(key))) {
+            throw std::runtime_error("无法读取临时文件");
+        }
+        if (disk_) {
+            disk_->Transfer(this, index * record_size_, sizeof(key), false);
+        }
+        return key;
+    }
+
+    // [first, last) 中第一个不小于 key（upper 为 true 时为大于 key）的记录的序号，调用方保证结果在这个范围内
+    uint64_t Bound(int64_t key, bool upper, uint64_t first = 0, uint64_t last = UINT64_MAX) {
+        uint64_t lo = first;
+        uint64_t hi = std::min(last, records_);
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            int64_t value = Key(mid);
+            if (value < key || (upper && value == key)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+private:
+    int fd_;
+    size_t record_size_;
+    SimulatedDisk* disk_;
+    uint64_t records_ = 0;
+};
+
+// 归并路数：可用预算能容纳的输入流缓存个数乘以压力系数，至少两路。整数和字符串的归并共用
+size_t MergeFanIn(MemoryBudget& memory) {
+    size_t streams = static_cast<size_t>(memory.Available() * memory.Scale()) / MERGE_STREAM_BUFFER;
+    return std::min(std::max<size_t>(streams, 2), MAX_MERGE_FAN_IN);
+}
+
+// 每个工作线程独立使用的缓存和状态，主线程也有一份
+struct WorkerState {
+    WorkerState(MemoryBudget& memory, size_t cache_size) : buffer_memory(memory, cache_size, "写出缓存"), buffer(cache_size) {}
+
+    MemoryReservation buffer_memory;
+    Buffer buffer; // 写出缓存
+    uint64_t output_checksum = CHECKSUM_SEED; // 当前正在写出的归并段的校验和
+    MultisetHash input_hash; // 当前输入文件读入的键的哈希
+    std::vector<RunManifest::RunInfo> pending_runs; // 当前输入文件已经写出、尚未记录进清单的归并段
+    std::unique_ptr<DiskOutputFile> run_output; // 正在写出的自然归并段，当前文件中接续的有序块追加到它后面
+    std::string run_path;
+    int64_t run_last = 0; // 自然归并段最后写出的键
+    size_t run_blocks = 0; // 自然归并段中的数据块数
+    bool run_ordered = false; // 自然归并段中的块都是读入时就有序的
+    std::string borrow_path; // 当前输入文件可以直接作为归并段引用时为它的路径，处理第一个块后清空
+    uintmax_t borrow_size = 0; // 当前输入文件的字节数
+    bool run_deferred = false; // 自然归并段还没有写出，它就是 run_path 指向的输入文件的前 run_keys 个键
+    uint64_t run_keys = 0;
+    SortStats stats;
+    int numa_node = -1; // 线程绑定的 NUMA 节点，-1 表示未绑定
 };
 
 // 外部排序类
 class ExternalSorter {
 public:
-    ExternalSorter(const std::string& output_path) : output_path_(output_path), buffer_(CACHE_SIZE) {}
+    // memory 为空时按 options.memory_limit 建立自己的预算；分布式排序的工作进程传入整个进程共用的预算
+    ExternalSorter(const std::string& output_path, const SortOptions& options = SortOptions(),
+                   MemoryBudget* memory = nullptr)
+        : output_path_(output_path), options_(options),
+          owned_memory_(memory ? nullptr : std::make_unique<MemoryBudget>(options.memory_limit, DEFAULT_MEMORY_BUDGET)),
+          memory_(memory ? *memory : *owned_memory_), main_state_(memory_, CACHE_SIZE) {}
 
     void Sort(const std::vector<std::string>& input_files) {
+        // 需要的键能放进内存时，流式读取一遍输入即可，不需要外部归并
+        if (options_.limit > 0 && options_.limit <= TopKCapacity()) {
+            // 堆占用的内存释放之后再扫描输出生成索引
+            if (SelectTopK(input_files)) {
+                PublishIndex(output_path_, false);
+                PrepareHash(output_path_);
+                PublishHash(output_path_, true);
+            }
+            return;
+        }
+
+        if (ChooseBucketEngine(input_files)) {
+            DistributionSort(input_files);
+            return;
+        }
+
+        // 增量模式下已有的输出本身就是有序的归并段
+        std::string base_run;
+        if (options_.incremental && std::filesystem::exists(output_path_)) {
+            // 已有输出的聚合方式和记录格式必须与本次相同，否则归并出的结果没有意义
+            SumInfo base;
+            if (!ReadSumFile(output_path_ + SUM_SUFFIX, base) || base.mode != ModeName() ||
+                base.record_size != RecordSize() || base.partitions != 0) {
+                throw std::runtime_error("无法确认已有输出 " + output_path_ + " 与本次使用相同的聚合方式，不能增量合并");
+            }
+            base_run = output_path_;
+            borrowed_runs_.insert(base_run);
+            // 新输出的哈希等于已有输出的哈希加上新输入的哈希
+            if (base.has_hash) {
+                ingest_hash_.Merge(base.hash);
+            } else {
+                ingest_hash_valid_ = false;
+            }
+        }
+
+        if (options_.numa) {
+            numa_nodes_ = DetectNumaNodes();
+            if (numa_nodes_.size() < 2) {
+                numa_nodes_.clear();
+            }
+            stats_.numa_nodes = numa_nodes_.size();
+        }
+
         std::vector<std::string> temp_files;
+        if (!options_.job_id.empty() && !ResumeJob(input_files, temp_files, base_run)) {
+            return;
+        }
         SplitAndSort(input_files, temp_files);
-        MergeInBatches(temp_files, output_path_);
+        if (options_.partitions > 0) {
+            MergePartitions(temp_files);
+        } else {
+            MergeInBatches(temp_files, output_path_, base_run);
+        }
         Cleanup(temp_files);
     }
 
+    const MemoryBudget& GetMemoryBudget() const { return memory_; }
+
+    const std::vector<PartitionInfo>& GetPartitions() const { return partitions_; }
+
+    SortStats GetStats() const {
+        SortStats total = stats_;
+        total.Add(main_state_.stats);
+        return total;
+    }
+
 private:
     std::string output_path_;
-    Buffer buffer_; // 缓存
-    std::mutex file_mutex_; // 保护文件流访问的互斥量
+    SortOptions options_;
+    std::unique_ptr<MemoryBudget> owned_memory_;
+    MemoryBudget& memory_; // 所有按数据量分配的缓存都在这里登记
+    WorkerState main_state_; // 主线程（归并以及不分线程的拆分阶段）使用的缓存和状态
+    std::mutex file_mutex_; // 保护工作线程共享的归并段列表、清单和哈希
+    std::unordered_set<std::string> borrowed_runs_; // 直接引用的有序输入文件和增量模式下已有的输出，不能删除或移动
+    SortStats stats_;
+    std::string job_dir_; // 断点续排任务的目录
+    std::unique_ptr<RunManifest> manifest_; // 断点续排的清单，未指定任务 ID 时为空
+    size_t temp_counter_ = 0; // 临时文件的编号
+    std::unique_ptr<IndexBuilder> index_builder_; // 最终归并期间接收写出的每个键
+    MultisetHash ingest_hash_; // 所有读入（并通过范围过滤）的键的多重集合哈希
+    bool ingest_hash_valid_ = true; // 增量模式下已有输出缺少 .sum 时无法得到完整的哈希
+    std::vector<NumaNode> numa_nodes_; // 启用 NUMA 模式时使用的节点，单节点机器上为空
+    std::atomic<size_t> active_workers_{1}; // 正在生成归并段的线程数，数据块的预算在它们之间平分
+    std::vector<PartitionInfo> partitions_; // 分区输出的各个文件
 
-    void SplitAndSort(const std::vector<std::string>& input_files, std::vector<std::string>& temp_files) {
-        for (const auto& file_path : input_files) {
-            std::ifstream input(file_path, std::ios::binary);
-            if (!input.is_open()) {
-                std::cerr << "无法打开文件: " << file_path << std::endl;
-                continue;
-            }
+    uint32_t RecordSize() const {
+        return options_.mode == AggregateMode::kCount ? 2 * sizeof(int64_t) : sizeof(int64_t);
+    }
 
-            std::vector<int64_t> data_block;
-            int64_t value;
-            while (input.read(reinterpret_cast<char*>(&value), sizeof(value))) {
-                data_block.push_back(value);
-                if (data_block.size() == BLOCK_SIZE) {
-                    SortAndWriteBlock(data_block, temp_files);
-                    data_block.clear();
-                }
-            }
+    bool IndexEnabled() const { return options_.build_index && !options_.descending; }
 
-            if (!data_block.empty()) {
-                SortAndWriteBlock(data_block, temp_files);
-            }
+    // 索引写到输出文件旁边的 .idx.tmp，输出文件就位之后由 PublishIndex 改名
+    std::unique_ptr<IndexBuilder> NewIndexBuilder(const std::string& output_path) const {
+        return std::make_unique<IndexBuilder>(output_path + INDEX_SUFFIX + ".tmp", RecordSize(), options_.index_every,
+                                              options_.bloom_bits);
+    }
+
+    // 生成索引需要在预算中登记的内存，不生成索引时为 0
+    size_t IndexMemory() const {
+        return IndexEnabled() ? IndexBuilder::MemoryUsage(options_.index_every, options_.bloom_bits) : 0;
+    }
 
-            input.close();
+    // 写在 .sum 中的聚合方式
+    std::string ModeName() const {
+        if (options_.limit > 0) {
+            return options_.descending ? "largest" : "smallest";
         }
+        return options_.mode == AggregateMode::kCount ? "count"
+               : options_.mode == AggregateMode::kDistinct ? "distinct" : "none";
     }
 
-    void SortAndWriteBlock(std::vector<int64_t>& data_block, std::vector<std::string>& temp_files) {
-        std::sort(data_block.begin(), data_block.end());
+    // 去重和部分排序的输出不再是输入的同一批键，.sum 中只记录格式
+    bool HashEnabled() const {
+        return options_.mode != AggregateMode::kDistinct && options_.limit == 0 && ingest_hash_valid_;
+    }
 
-        // 将临时文件路径改为temp_sort文件夹下
-        std::string temp_file = "temp_sort/temp_" + std::to_string(std::rand()) + ".bin";
+    // 在最终结果改名之前写好 .sum 的临时文件，改名之后再由 PublishHash 发布
+    void PrepareHash(const std::string& output_path, size_t partitions = 0) {
+        SumInfo info;
+        info.mode = ModeName();
+        info.record_size = RecordSize();
+        info.partitions = static_cast<uint32_t>(partitions);
+        info.has_hash = HashEnabled();
+        info.hash = ingest_hash_;
+        if (!WriteSumFile(output_path + SUM_SUFFIX + ".tmp", info)) {
+            std::cerr << "无法写入哈希文件: " << output_path << SUM_SUFFIX << std::endl;
+        }
+    }
 
-        // 确保temp_sort文件夹存在
-        std::filesystem::create_directory("temp_sort");
+    // remove_stale 为 true 时，没有新哈希就删除旧的 .sum，避免与新输出不一致
+    void PublishHash(const std::string& output_path, bool remove_stale) {
+        std::string sum_path = output_path + SUM_SUFFIX;
+        if (std::filesystem::exists(sum_path + ".tmp")) {
+            std::filesystem::rename(sum_path + ".tmp", sum_path);
+        } else if (remove_stale) {
+            std::filesystem::remove(sum_path);
+        }
+    }
 
-        std::ofstream output(temp_file, std::ios::binary);
-        if (!output.is_open()) {
-            std::cerr << "无法打开临时文件: " << temp_file << std::endl;
+    // 输出文件就位之后再发布索引，保证索引不会比数据文件新
+    // index_ready 为 false 表示最终结果不是由归并产生的（只有一个归并段），需要扫描一遍输出来生成索引
+    void PublishIndex(const std::string& output_path, bool index_ready) {
+        std::string index_path = output_path + INDEX_SUFFIX;
+        if (!IndexEnabled()) {
+            std::filesystem::remove(index_path); // 避免留下与新输出不一致的旧索引
             return;
         }
-
-        for (int64_t value : data_block) {
-            if (!buffer_.Write(&value, sizeof(value))) {
-                // 如果缓存满了，先将缓存中的数据写入文件
-                FlushBuffer(output);
-                buffer_.Write(&value, sizeof(value));
+        if (!index_ready) {
+            MemoryReservation index_memory(memory_, IndexMemory(), "索引缓存");
+            auto builder = NewIndexBuilder(output_path);
+            DiskInputFile input;
+            OpenUnbuffered(input, output_path);
+            MemoryReservation chunk_memory(memory_, CACHE_SIZE, "索引扫描缓存");
+            std::vector<char> chunk(CACHE_SIZE);
+            size_t record_size = RecordSize();
+            while (input.read(chunk.data(), chunk.size()) || input.gcount() > 0) {
+                for (size_t i = 0; i + record_size <= static_cast<size_t>(input.gcount()); i += record_size) {
+                    int64_t key;
+                    std::memcpy(&key, chunk.data() + i, sizeof(key));
+                    builder->Add(key);
+                }
+            }
+            if (!builder->Finish()) {
+                std::cerr << "无法写入索引文件: " << index_path << std::endl;
+                return;
             }
         }
-
-        // 将剩余的数据写入文件
-        FlushBuffer(output);
-        temp_files.push_back(temp_file);
+        std::filesystem::rename(index_path + ".tmp", index_path);
     }
 
-    void FlushBuffer(std::ofstream& output) {
-        if (!buffer_.IsEmpty()) {
-            // 使用Buffer的公共方法获取缓存数据和写入位置
-            output.write(buffer_.GetBuffer(), buffer_.GetWritePos());
-            buffer_.Reset();
+    // 任务指纹：影响归并段内容的选项、记录大小和输入文件列表，继续任务时必须与上次完全相同
+    std::string JobFingerprint(const std::vector<std::string>& input_files) const {
+        std::string ranges;
+        for (const auto& range : options_.ranges) {
+            ranges += (ranges.empty() ? "" : ",") + std::to_string(range.first) + ":" + std::to_string(range.second);
         }
+        uint64_t inputs = CHECKSUM_SEED;
+        for (const auto& file : input_files) {
+            inputs = UpdateChecksum(inputs, file.c_str(), file.size() + 1);
+        }
+        return "mode=" + ModeName() + " record_size=" + std::to_string(RecordSize()) + " ranges=" + ranges +
+               " text=" + std::to_string(options_.text_input) + " column=" + std::to_string(options_.text_column) +
+               " delimiter=" + std::to_string(static_cast<int>(options_.delimiter)) +
+               " incremental=" + std::to_string(options_.incremental) + " inputs=" +
+               std::to_string(input_files.size()) + ":" + std::to_string(inputs);
     }
 
-    void MergeInBatches(std::vector<std::string>& temp_files, const std::string& output_path) {
-        while (temp_files.size() > 1) {
-            std::vector<std::string> next_batch_files;
-            for (size_t i = 0; i < temp_files.size(); i += MERGE_BATCH_SIZE) {
-                // 合并最多8个文件
-                size_t batch_end = std::min(i + MERGE_BATCH_SIZE, temp_files.size());
-                std::vector<std::string> batch_files(temp_files.begin() + i, temp_files.begin() + batch_end);
-                std::string merged_file = MergeFiles(batch_files);
-                next_batch_files.push_back(merged_file);
+    // 打开任务清单并恢复上次的进度，返回 false 表示任务上次已经全部完成。
+    // 选项、输入文件列表或已读完的输入文件与上次不同时拒绝继续，否则会把格式或内容不一致的归并段归并在一起
+    bool ResumeJob(const std::vector<std::string>& input_files, std::vector<std::string>& temp_files,
+                   std::string& base_run) {
+        job_dir_ = "temp_sort/" + options_.job_id;
+        std::filesystem::create_directories(job_dir_);
+        manifest_ = std::make_unique<RunManifest>(job_dir_);
+        std::string fingerprint = JobFingerprint(input_files);
+        if (!manifest_->Load()) {
+            manifest_->Reset(); // 清掉没有记录就中断时留下的文件
+            manifest_->RecordJob(fingerprint);
+            return true;
+        }
+        std::string mismatch = "任务 " + options_.job_id + " 的清单 " + manifest_->GetPath();
+        if (manifest_->Fingerprint() != fingerprint) {
+            throw std::runtime_error(mismatch + " 记录的选项或输入文件列表与本次不同，请换一个任务 ID 或删除 " + job_dir_);
+        }
+        for (const auto& [file, recorded] : manifest_->DoneInputs()) {
+            RunManifest::InputInfo current = RunManifest::StatInput(file);
+            if (current.size != recorded.size || current.mtime != recorded.mtime) {
+                throw std::runtime_error(mismatch + " 之后输入文件 " + file + " 被修改过，请换一个任务 ID 或删除 " + job_dir_);
             }
-            temp_files = std::move(next_batch_files); // 更新临时文件列表
+        }
+        if (manifest_->IsDone()) {
+            manifest_->Finish();
+            std::cout << "任务 " << options_.job_id << " 已经完成" << std::endl;
+            return false;
         }
 
-        // 最终合并文件
-        std::filesystem::rename(temp_files[0], output_path);
-    }
-
-    std::string MergeFiles(const std::vector<std::string>& files) {
-        std::priority_queue<std::pair<int64_t, std::shared_ptr<std::ifstream>>, 
-                            std::vector<std::pair<int64_t, std::shared_ptr<std::ifstream>>>, 
-                            std::greater<>> min_heap;
-
-        std::vector<std::shared_ptr<std::ifstream>> streams;
-        for (const auto& file : files) {
-            auto input = std::make_shared<std::ifstream>(file, std::ios::binary);
-            if (!input->is_open()) {
-                std::cerr << "无法打开临时文件: " << file << std::endl;
-                continue;
+        const auto& runs = manifest_->LiveRuns();
+        // 最终结果已经改名为输出文件，只是还没来得及记录 done
+        if (runs.size() == 1 && !std::filesystem::exists(runs[0].path)) {
+            RunManifest::RunInfo output = runs[0];
+            output.path = output_path_;
+            if (IsRunIntact(output)) {
+                PublishIndex(output_path_, false);
+                PublishHash(output_path_, false);
+                manifest_->Finish();
+                std::cout << "任务 " << options_.job_id << " 已经完成" << std::endl;
+                return false;
             }
+        }
 
-            int64_t value;
-            if (input->read(reinterpret_cast<char*>(&value), sizeof(value))) {
-                std::lock_guard<std::mutex> lock(file_mutex_);  // 保护文件流的访问
-                min_heap.push({value, input});
-            } else {
-                std::cerr << "无法从临时文件读取: " << file << std::endl;
+        for (const auto& run : runs) {
+            if (!IsRunIntact(run)) {
+                std::cerr << "清单中的归并段已损坏: " << run.path << "，重新开始任务" << std::endl;
+                manifest_->Reset();
+                manifest_->RecordJob(fingerprint);
+                return true;
             }
-            streams.push_back(input);
         }
 
-        std::string merged_file = "temp_sort/merged_" + std::to_string(rand()) + ".bin";
-        std::ofstream output(merged_file, std::ios::binary);
-        if (!output.is_open()) {
-            std::cerr << "无法打开合并文件: " << merged_file << std::endl;
-            return merged_file;
+        // 删除上次中断时写了一半、没有记录进清单的文件
+        std::unordered_set<std::string> live;
+        std::unordered_set<std::string> inputs(input_files.begin(), input_files.end());
+        for (const auto& run : runs) {
+            live.insert(run.path);
+            temp_files.push_back(run.path);
+            if (inputs.count(run.path)) {
+                borrowed_runs_.insert(run.path); // 上次直接引用的有序输入文件
+            }
         }
-
-        while (!min_heap.empty()) {
-            auto [value, stream] = min_heap.top();
-            min_heap.pop();
-            output.write(reinterpret_cast<const char*>(&value), sizeof(value));
-
-            if (stream->read(reinterpret_cast<char*>(&value), sizeof(value))) {
-                min_heap.push({value, stream});
+        for (const auto& entry : std::filesystem::directory_iterator(job_dir_)) {
+            std::string path = entry.path().string();
+            if (path != manifest_->GetPath() && !live.count(path)) {
+                std::filesystem::remove(path);
             }
         }
 
-        // 合并完一个文件后，删除临时文件
-        for (const auto& file : files) {
-            std::filesystem::remove(file);
+        // 已有的输出已经在上次的最终归并中用过了
+        if (manifest_->IsConsumed(base_run)) {
+            base_run.clear();
         }
-
-        return merged_file;
+        stats_.resumed_runs = runs.size();
+        ingest_hash_.Merge(manifest_->InputHash());
+        return true;
     }
 
-    void Cleanup(const std::vector<std::string>& temp_files) {
-        for (const auto& file : temp_files) {
-            std::filesystem::remove(file);
+    bool IsRunIntact(const RunManifest::RunInfo& run) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(run.path, ec);
+        if (ec || size != run.size) {
+            return false;
         }
+        MemoryReservation chunk_memory(memory_, CACHE_SIZE, "校验缓存");
+        return ChecksumFile(run.path) == run.checksum;
     }
-};
 
-int main() {
-    std::string input_dir = "test_files"; // 更新为包含names.txt的文件夹路径
-    std::string output_file = "sorted_data.bin";
-    std::vector<std::string> input_files;
-
-    // 从test_files/names.txt文件中读取需要排序的文件名
-    std::ifstream name_file(input_dir + "/names.txt"); // 更新文件路径
-    if (name_file.is_open()) {
-        std::string file_name;
-        while (std::getline(name_file, file_name)) {
-            input_files.push_back(input_dir + "/" + file_name);
+    // 生成新的临时文件名；断点续排时使用任务目录下按编号递增的文件名
+    std::string NewTempFile(const std::string& prefix) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        std::filesystem::create_directory("temp_sort");
+        // 文件名带上进程号，多个进程共用 temp_sort 时不会重名，失败时也能找出某个进程留下的文件
+        if (!manifest_) {
+            return "temp_sort/" + prefix + "_" + std::to_string(::getpid()) + "_" + std::to_string(temp_counter_++) +
+                   ".bin";
         }
-        name_file.close();
-    } else {
-        std::cerr << "无法打开names.txt" << std::endl;
-        return -1;
+        std::string path;
+        do {
+            path = job_dir_ + "/" + prefix + "_" + std::to_string(temp_counter_++) + ".bin";
+        } while (std::filesystem::exists(path));
+        return path;
     }
 
-    ExternalSorter sorter(output_file);
-    sorter.Sort(input_files);
+    // 写完一个归并段后刷盘并取得它的清单信息
+    RunManifest::RunInfo FinishRun(WorkerState& state, DiskOutputFile& output, const std::string& path) {
+        output.close();
+        SyncPath(path);
+        RunManifest::RunInfo run;
+        run.path = path;
+        run.size = std::filesystem::file_size(path);
+        run.checksum = state.output_checksum;
+        return run;
+    }
 
+    void SplitAndSort(const std::vector<std::string>& input_files, std::vector<std::string>& temp_files) {
+        // 每个线程至少要有写出缓存、文本读取缓存和最小的数据块，预算不够时少用几个节点，
+        // 不足两个节点时在主线程中依次处理
+        size_t per_worker = 2 * CACHE_SIZE + MIN_BLOCK_KEYS * sizeof(int64_t);
+        size_t workers = std::min(numa_nodes_.size(), memory_.Available() / per_worker);
+        if (workers < 2) {
+            stats_.numa_nodes = 0;
+            for (const auto& file_path : input_files) {
+                ProcessFile(main_state_, file_path, temp_files);
+            }
+            return;
+        }
+        stats_.numa_nodes = workers;
+        active_workers_ = workers;
+
+        // 每个 NUMA 节点一个工作线程，绑定之后再分配数据块和写出缓存，
+        // 这样线程读入的块在本节点的内存中完成排序和写出
+        std::atomic<size_t> next_file{0};
+        std::vector<std::future<void>> futures;
+        for (size_t w = 0; w < workers; ++w) {
+            futures.push_back(std::async(std::launch::async, [&, node = numa_nodes_[w]]() {
+                BindToNumaNode(node);
+                WorkerState state(memory_, CACHE_SIZE);
+                state.numa_node = node.id;
+                for (size_t i = next_file++; i < input_files.size(); i = next_file++) {
+                    ProcessFile(state, input_files[i], temp_files);
+                }
+                std::lock_guard<std::mutex> lock(file_mutex_);
+                stats_.Add(state.stats);
+            }));
+        }
+        for (auto& fut : futures) {
+            fut.get();
+        }
+        active_workers_ = 1;
+
+        // 归并在主线程进行，把它绑定到第一个节点，归并用的缓存随后在本地分配
+        BindToNumaNode(numa_nodes_[0]);
+        main_state_.numa_node = numa_nodes_[0].id;
+    }
+
+    void ProcessFile(WorkerState& state, const std::string& file_path, std::vector<std::string>& temp_files) {
+        // 上次运行中已经处理完的输入文件，它的归并段已从清单恢复
+        if (manifest_ && manifest_->IsInputDone(file_path)) {
+            ++state.stats.resumed_inputs;
+            return;
+        }
+
+        state.input_hash = MultisetHash();
+
+        KeySource input(file_path, options_, memory_);
+        if (!input.IsOpen()) {
+            std::cerr << "无法打开文件: " << file_path << std::endl;
+            return;
+        }
+
+        // 数据块的内存先在预算中登记；每写出一个块都按当前的预算和内存压力重新确定大小
+        size_t block_keys = TargetBlockKeys(0);
+        MemoryReservation block_memory(memory_, block_keys * sizeof(int64_t), "数据块");
+        KeyBlock data_block;
+        data_block.reserve(block_keys);
+        // 键原样来自文件、没有过滤也没有改变格式时，整体有序的文件本身就可以作为归并段
+        std::error_code ec;
+        state.borrow_size = std::filesystem::file_size(file_path, ec);
+        bool borrowable = options_.mode == AggregateMode::kNone && !options_.descending && options_.ranges.empty() &&
+                          !options_.text_input && !ec && state.borrow_size > 0 &&
+                          state.borrow_size % sizeof(int64_t) == 0;
+        state.borrow_path = borrowable ? file_path : std::string();
+        bool more = true;
+        size_t blocks = 0;
+        while (more) {
+            more = ReadKeys(state, input, data_block, std::min(block_keys - data_block.size(), READ_STEP_KEYS));
+            // 内存压力升高时不等数据块读满，先把已经读入的键写成一个归并段
+            bool full = data_block.size() == block_keys;
+            if (full || (more && data_block.size() >= TargetBlockKeys(block_memory.Size()))) {
+                ++blocks;
+                SortAndWriteBlock(state, data_block, temp_files);
+                data_block.clear();
+                ResizeBlock(state, data_block, block_memory, block_keys);
+            }
+        }
+
+        if (!data_block.empty()) {
+            ++blocks;
+            SortAndWriteBlock(state, data_block, temp_files);
+        }
+        // 整个文件只形成了一个归并段、每个块读入时都有序，说明它本身就是有序的，只读了一遍、没有排序
+        if ((state.run_output || state.run_deferred) && state.run_ordered && state.run_blocks == blocks) {
+            ++state.stats.presorted_files;
+        }
+        CloseRun(state, temp_files);
+
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        ingest_hash_.Merge(state.input_hash);
+        if (manifest_) {
+            manifest_->RecordInput(file_path, state.pending_runs, state.input_hash);
+            state.pending_runs.clear();
+        }
+    }
+
+    // 数据块的目标键数：可用预算加上本线程已经占用的数据块，在工作线程间平分后再乘以压力系数。
+    // 分块排序的归并缓存不超过块的 1/8 时从中留出，块较小时整份都给数据块，归并段少比块内排序快更重要
+    size_t TargetBlockKeys(size_t held_bytes) {
+        size_t share = (memory_.Available() + held_bytes) / active_workers_;
+        size_t keys = static_cast<size_t>(share * memory_.Scale()) / sizeof(int64_t);
+        size_t scratch_keys = ChunkKeysFor(keys);
+        if (scratch_keys * 8 <= keys) {
+            keys -= scratch_keys;
+        }
+        return std::max(keys, MIN_BLOCK_KEYS);
+    }
+
+    // 目标与当前大小相差一倍以上时才重新分配数据块，避免来回调整
+    // 缩小时先释放内存再减少登记，扩大时先登记成功再分配
+    void ResizeBlock(WorkerState& state, KeyBlock& data_block, MemoryReservation& block_memory,
+                     size_t& block_keys) {
+        size_t target = TargetBlockKeys(block_memory.Size());
+        if (target > block_keys / 2 && target < block_keys * 2) {
+            return;
+        }
+        if (target > block_keys && !block_memory.Resize(target * sizeof(int64_t))) {
+            return;
+        }
+        KeyBlock().swap(data_block);
+        block_memory.Resize(target * sizeof(int64_t));
+        data_block.reserve(target);
+        block_keys = target;
+        ++state.stats.block_resizes;
+    }
+
+    // 从输入读取最多 max_count 个键追加到 keys 末尾，并在写入数据块之前完成范围过滤
+    // 返回 false 表示文件已经读完
+    template <typename Keys>
+    bool ReadKeys(WorkerState& state, KeySource& input, Keys& keys, size_t max_count) {
+        size_t old_size = keys.size();
+        keys.resize(old_size + max_count);
+        size_t count = input.Read(keys.data() + old_size, max_count);
+        size_t kept = FilterKeys(keys.data() + old_size, count);
+        keys.resize(old_size + kept);
+        for (size_t i = old_size; i < keys.size(); ++i) {
+            state.input_hash.Add(keys[i]);
+        }
+        state.stats.scanned_keys += count;
+        state.stats.kept_keys += kept;
+        return count == max_count;
+    }
+
+    // 原地压缩出落在范围内的键，返回保留的个数
+    // 每个键无条件写回、按判断结果前移写指针，循环中没有分支，便于编译器向量化判断部分
+    size_t FilterKeys(int64_t* keys, size_t count) const {
+        if (options_.ranges.empty()) {
+            return count;
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t value = static_cast<uint64_t>(keys[i]);
+            bool in_range = false;
+            for (const auto& range : options_.ranges) {
+                // 无符号减法把 lo <= v <= hi 化为一次比较
+                uint64_t lo = static_cast<uint64_t>(range.first);
+                in_range |= value - lo <= static_cast<uint64_t>(range.second) - lo;
+            }
+            keys[kept] = keys[i];
+            kept += in_range;
+        }
+        return kept;
+    }
+
+    // 按输出顺序判断 a 是否应排在 b 之前
+    bool Before(int64_t a, int64_t b) const {
+        return options_.descending ? a > b : a < b;
+    }
+
+    // 用大小为 N 的堆流式筛选最小（或最大）的 N 个键，堆顶就是当前阈值，绝大多数键只需一次比较就被丢弃
+    // 堆最多能容纳的键数：可用预算还要留出至少 MIN_BLOCK_KEYS 个键的读入缓存。
+    // 用除法而不是把键数乘回字节数，很大的 --smallest/--largest 不会溢出
+    size_t TopKCapacity() {
+        size_t keys = memory_.Available() / sizeof(int64_t);
+        return keys < MIN_BLOCK_KEYS ? 0 : keys - MIN_BLOCK_KEYS;
+    }
+
+    // 调用者保证 options_.limit 不超过 TopKCapacity()
+    bool SelectTopK(const std::vector<std::string>& input_files) {
+        WorkerState& state = main_state_;
+        auto before = [this](int64_t a, int64_t b) { return Before(a, b); };
+        size_t chunk_keys = std::min(BLOCK_SIZE, memory_.Available() / sizeof(int64_t) - options_.limit);
+        MemoryReservation heap_memory(memory_, (options_.limit + chunk_keys) * sizeof(int64_t), "部分排序的堆");
+        std::vector<int64_t> heap;
+        heap.reserve(options_.limit);
+        std::vector<int64_t> chunk;
+        chunk.reserve(chunk_keys);
+
+        for (const auto& file_path : input_files) {
+            KeySource input(file_path, options_, memory_);
+            if (!input.IsOpen()) {
+                std::cerr << "无法打开文件: " << file_path << std::endl;
+                continue;
+            }
+
+            bool more = true;
+            while (more) {
+                chunk.clear();
+                more = ReadKeys(state, input, chunk, chunk_keys);
+                for (int64_t value : chunk) {
+                    if (heap.size() < options_.limit) {
+                        heap.push_back(value);
+                        std::push_heap(heap.begin(), heap.end(), before);
+                    } else if (before(value, heap.front())) {
+                        std::pop_heap(heap.begin(), heap.end(), before);
+                        heap.back() = value;
+                        std::push_heap(heap.begin(), heap.end(), before);
+                    }
+                }
+            }
+        }
+
+        std::sort_heap(heap.begin(), heap.end(), before);
+
+        DiskOutputFile output;
+        OpenUnbuffered(output, output_path_);
+        if (!output.is_open()) {
+            std::cerr << "无法打开输出文件: " << output_path_ << std::endl;
+            return false;
+        }
+        for (int64_t value : heap) {
+            BufferedWrite(state, output, &value, sizeof(value));
+        }
+        FlushBuffer(state, output);
+        return true;
+    }
+
+    // 数据块在读入的同时预扫描，已按输出顺序排列的块跳过排序，方向相反的块只需反转。
+    // 这样的块如果接在上一个块写出的最后一个键之后，就追加到同一个归并段，文件中连续有序的部分
+    // 成为一个自然归并段，不需要预先整体扫描。从文件开头起一直有序时先不写出：整个文件都有序就直接引用
+    // 输入文件作为归并段，只顺序读一遍；中途出现无序的块时，才把有序的前缀从输入文件复制成归并段
+    void SortAndWriteBlock(WorkerState& state, KeyBlock& data_block, std::vector<std::string>& temp_files) {
+        std::string borrow_path = std::move(state.borrow_path);
+        state.borrow_path.clear();
+        RunOrder order = DetectRunOrder(data_block.data(), data_block.size());
+        RunOrder wanted = options_.descending ? RunOrder::kDescending : RunOrder::kAscending;
+        size_t chunk_keys = data_block.size();
+        bool ordered = order != RunOrder::kUnsorted;
+        if (order == wanted) {
+            ++state.stats.presorted_blocks;
+        } else if (ordered) {
+            std::reverse(data_block.begin(), data_block.end());
+            ++state.stats.reversed_blocks;
+        } else {
+            chunk_keys = SortBlockChunks(data_block);
+            ++state.stats.sorted_blocks;
+        }
+
+        // 聚合模式下相同的键必须在写出时合并，只有严格接续的块才能追加
+        bool extend = (state.run_output || state.run_deferred) && ordered &&
+                      (Before(state.run_last, data_block.front()) ||
+                       (options_.mode == AggregateMode::kNone && state.run_last == data_block.front()));
+        if (state.run_deferred) {
+            if (extend && order == wanted) {
+                DeferBlock(state, data_block);
+                return;
+            }
+            MaterializeRun(state);
+        }
+        if (!extend && !borrow_path.empty() && order == wanted) {
+            CloseRun(state, temp_files);
+            state.run_path = borrow_path;
+            state.run_deferred = true;
+            state.run_keys = 0;
+            state.output_checksum = CHECKSUM_SEED;
+            state.run_blocks = 0;
+            state.run_ordered = true;
+            DeferBlock(state, data_block);
+            return;
+        }
+        if (!extend) {
+            CloseRun(state, temp_files);
+            // 将临时文件路径改为temp_sort文件夹下
+            state.run_path = NewTempFile("temp");
+            state.run_output = std::make_unique<DiskOutputFile>();
+            OpenUnbuffered(*state.run_output, state.run_path);
+            if (!state.run_output->is_open()) {
+                std::cerr << "无法打开临时文件: " << state.run_path << std::endl;
+                state.run_output.reset();
+                return;
+            }
+            state.output_checksum = CHECKSUM_SEED;
+            state.run_blocks = 0;
+            state.run_ordered = ordered;
+        }
+
+        if (options_.descending) {
+            WriteMergedChunks<true>(state, *state.run_output, data_block, chunk_keys);
+        } else {
+            WriteMergedChunks<false>(state, *state.run_output, data_block, chunk_keys);
+        }
+        ++state.run_blocks;
+        if (state.numa_node >= 0) {
+            CountPagePlacement(data_block.data(), data_block.size() * sizeof(int64_t), state.numa_node, state.stats);
+        }
+    }
+
+    // 输入文件中接续的有序块，只记录它的键数和校验和，不写出
+    void DeferBlock(WorkerState& state, const KeyBlock& data_block) {
+        state.run_keys += data_block.size();
+        state.output_checksum = UpdateChecksum(state.output_checksum, reinterpret_cast<const char*>(data_block.data()),
+                                               data_block.size() * sizeof(int64_t));
+        state.run_last = data_block.back();
+        ++state.run_blocks;
+    }
+
+    // 有序的前缀不能再直接引用：用写出缓存把它从输入文件复制成一个真正的归并段，之后的块照常追加。
+    // 内容不变，已经算好的校验和仍然有效
+    void MaterializeRun(WorkerState& state) {
+        std::string input_path = state.run_path;
+        state.run_deferred = false;
+        state.run_path = NewTempFile("temp");
+        state.run_output = std::make_unique<DiskOutputFile>();
+        OpenUnbuffered(*state.run_output, state.run_path);
+        DiskInputFile input;
+        OpenUnbuffered(input, input_path);
+        if (!state.run_output->is_open() || !input.is_open()) {
+            throw std::runtime_error("无法把有序的前缀复制成归并段: " + input_path);
+        }
+        uint64_t remaining = state.run_keys * sizeof(int64_t);
+        char* chunk = state.buffer.GetBuffer();
+        size_t chunk_size = state.buffer_memory.Size();
+        while (remaining > 0) {
+            size_t size = static_cast<size_t>(std::min<uint64_t>(remaining, chunk_size));
+            if (!input.read(chunk, size)) {
+                throw std::runtime_error("无法把有序的前缀复制成归并段: " + input_path);
+            }
+            state.run_output->write(chunk, size);
+            remaining -= size;
+        }
+    }
+
+    // 写完正在写出的自然归并段并把它加入归并段列表
+    void CloseRun(WorkerState& state, std::vector<std::string>& temp_files) {
+        if (state.run_deferred && state.run_keys * sizeof(int64_t) != state.borrow_size) {
+            MaterializeRun(state); // 没有读到文件末尾（例如读取出错），只能复制读到的部分
+        }
+        if (state.run_deferred) {
+            // 整个输入文件就是一个归并段，直接引用，不复制
+            state.run_deferred = false;
+            RunManifest::RunInfo run;
+            run.path = state.run_path;
+            run.size = state.borrow_size;
+            run.checksum = state.output_checksum;
+            if (manifest_) {
+                state.pending_runs.push_back(run);
+            }
+            std::lock_guard<std::mutex> lock(file_mutex_);
+            temp_files.push_back(state.run_path);
+            borrowed_runs_.insert(state.run_path);
+            return;
+        }
+        if (!state.run_output) {
+            return;
+        }
+        // 将剩余的数据写入文件
+        FlushBuffer(state, *state.run_output);
+        if (manifest_) {
+            state.pending_runs.push_back(FinishRun(state, *state.run_output, state.run_path));
+        }
+        state.run_output.reset();
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        temp_files.push_back(state.run_path);
+    }
+
+    // 把数据块切成缓存大小的分块分别排序，返回分块的键数。分块内归并用的缓存也在预算中登记，
+    // 块很小或者登记不下时退回到对整块 std::sort，此时整个块就是一个分块
+    size_t SortBlockChunks(KeyBlock& data_block) {
+        size_t chunk_keys = ChunkKeysFor(data_block.size());
+        MemoryReservation scratch_memory(memory_, 0, "分块排序缓存");
+        if (data_block.size() < MIN_CHUNK_SORT_KEYS || !scratch_memory.Resize(chunk_keys * sizeof(int64_t))) {
+            std::sort(data_block.begin(), data_block.end(), [this](int64_t a, int64_t b) { return Before(a, b); });
+            return data_block.size();
+        }
+        std::vector<int64_t> scratch(chunk_keys);
+        if (options_.descending) {
+            SortChunks<true>(data_block.data(), data_block.size(), scratch.data(), chunk_keys);
+        } else {
+            SortChunks<false>(data_block.data(), data_block.size(), scratch.data(), chunk_keys);
+        }
+        return chunk_keys;
+    }
+
+    // 用败者树按顺序取出各分块的键写成归并段。排序后重复键相邻，在写出之前合并掉；
+    // 部分排序时每个归并段最多只需要保留前 N 个键
+    template <bool Descending>
+    void WriteMergedChunks(WorkerState& state, DiskOutputFile& output, const KeyBlock& data_block, size_t chunk_keys) {
+        ChunkMerger<Descending> merger(data_block.data(), data_block.size(), chunk_keys);
+        uint64_t remaining = options_.limit > 0 ? options_.limit : UINT64_MAX;
+        int64_t key;
+        bool has_key = merger.Next(key);
+        while (has_key && remaining > 0) {
+            int64_t current = key;
+            uint64_t times = 1;
+            while ((has_key = merger.Next(key)) && options_.mode != AggregateMode::kNone && key == current) {
+                ++times;
+            }
+            WriteRecord(state, output, current, times);
+            state.run_last = current;
+            state.stats.collapsed_duplicates += times - 1;
+            --remaining;
+        }
+    }
+
+    void BufferedWrite(WorkerState& state, DiskOutputFile& output, const void* data, size_t size) {
+        // 如果缓存满了，先将缓存中的数据写入文件，避免缓存不断扩容
+        if (!state.buffer.Write(data, size)) {
+            FlushBuffer(state, output);
+            state.buffer.Write(data, size);
+        }
+    }
+
+    // 写出一条记录，计数模式下键后面紧跟 uint64 计数
+    void WriteRecord(WorkerState& state, DiskOutputFile& output, int64_t key, uint64_t count) {
+        if (index_builder_) {
+            index_builder_->Add(key);
+        }
+        BufferedWrite(state, output, &key, sizeof(key));
+        if (options_.mode == AggregateMode::kCount) {
+            BufferedWrite(state, output, &count, sizeof(count));
+        }
+    }
+
+    void FlushBuffer(WorkerState& state, DiskOutputFile& output) {
+        if (!state.buffer.IsEmpty()) {
+            // 使用Buffer的公共方法获取缓存数据和写入位置
+            output.write(state.buffer.GetBuffer(), state.buffer.GetWritePos());
+            state.output_checksum = UpdateChecksum(state.output_checksum, state.buffer.GetBuffer(), state.buffer.GetWritePos());
+            state.buffer.Reset();
+        }
+    }
+
+    // base_run 非空时为增量模式下已有的输出，它只参与最后一次归并，因此只被读取一次
+    void MergeInBatches(std::vector<std::string>& temp_files, const std::string& output_path,
+                        const std::string& base_run = "") {
+        // 没有任何键（例如全部被范围过滤掉）时输出空文件，增量模式下保留原有输出
+        if (temp_files.empty()) {
+            if (base_run.empty()) {
+                std::ofstream output(output_path, std::ios::binary | std::ios::trunc);
+                output.close();
+                PublishIndex(output_path, false);
+                PrepareHash(output_path);
+                PublishHash(output_path, true);
+            }
+            if (manifest_) {
+                manifest_->Finish();
+            }
+            return;
+        }
+
+        // 归并路数按当前的预算和内存压力逐批确定
+        size_t fan_in = MergeFanIn(memory_);
+        bool index_ready = false;
+        while (temp_files.size() > (base_run.empty() ? 1 : fan_in - 1)) {
+            // 最后一趟归并在写出结果的同时生成索引，不需要额外扫描
+            bool final_pass = base_run.empty() && temp_files.size() <= fan_in;
+            index_ready = final_pass;
+            std::vector<std::string> next_batch_files;
+            for (size_t i = 0; i < temp_files.size(); i += fan_in) {
+                if (!final_pass) {
+                    fan_in = MergeFanIn(memory_);
+                }
+                size_t batch_end = std::min(i + fan_in, temp_files.size());
+                std::vector<std::string> batch_files(temp_files.begin() + i, temp_files.begin() + batch_end);
+                std::string merged_file = MergeFiles(batch_files, final_pass);
+                next_batch_files.push_back(merged_file);
+            }
+            temp_files = std::move(next_batch_files); // 更新临时文件列表
+            fan_in = MergeFanIn(memory_);
+        }
+
+        if (!base_run.empty()) {
+            temp_files.push_back(base_run);
+            temp_files = {MergeFiles(temp_files, true)};
+            index_ready = true;
+        }
+
+        // 最后剩下的归并段就是最终结果，直接改名；它是直接引用的输入文件时不能移走，复制一份
+        PrepareHash(output_path);
+        if (borrowed_runs_.count(temp_files[0])) {
+            std::filesystem::copy_file(temp_files[0], output_path + ".tmp",
+                                       std::filesystem::copy_options::overwrite_existing);
+            std::filesystem::rename(output_path + ".tmp", output_path);
+            index_ready = false;
+        } else {
+            std::filesystem::rename(temp_files[0], output_path);
+        }
+        PublishIndex(output_path, index_ready);
+        PublishHash(output_path, true);
+        if (manifest_) {
+            SyncPath(output_path);
+            manifest_->Finish();
+        }
+    }
+
+    // final_merge 为 true 时这次归并的结果就是最终输出，写出时顺便生成索引
+    std::string MergeFiles(const std::vector<std::string>& files, bool final_merge = false) {
+        WorkerState& state = main_state_;
+        // 索引的内存先登记，剩下的才分给输入缓存
+        MemoryReservation index_memory(memory_, final_merge ? IndexMemory() : 0, "索引缓存");
+        // 输入流使用在预算中登记过的缓存，NUMA 模式下主线程已经绑定节点，缓存分配在本节点；缓存要比文件流活得久
+        size_t stream_buffer = std::min(MERGE_STREAM_BUFFER, memory_.Available() / std::max<size_t>(files.size(), 1));
+        stream_buffer = std::max(stream_buffer / sizeof(int64_t) * sizeof(int64_t), sizeof(int64_t));
+        MemoryReservation stream_memory(memory_, stream_buffer * files.size(), "归并输入缓存");
+        std::vector<std::unique_ptr<char[]>> stream_buffers;
+        using HeapItem = std::pair<int64_t, std::shared_ptr<DiskInputFile>>;
+        // 堆顶为按输出顺序最靠前的键
+        auto later = [this](const HeapItem& a, const HeapItem& b) { return Before(b.first, a.first); };
+        std::priority_queue<HeapItem, std::vector<HeapItem>, decltype(later)> heap(later);
+
+        std::vector<std::shared_ptr<DiskInputFile>> streams;
+        for (const auto& file : files) {
+            auto input = std::make_shared<DiskInputFile>();
+            stream_buffers.push_back(std::make_unique<char[]>(stream_buffer));
+            if (state.numa_node >= 0) {
+                std::memset(stream_buffers.back().get(), 0, stream_buffer);
+                CountPagePlacement(stream_buffers.back().get(), stream_buffer, state.numa_node, state.stats);
+            }
+            input->rdbuf()->pubsetbuf(stream_buffers.back().get(), stream_buffer);
+            input->open(file, std::ios::binary);
+            if (!input->is_open()) {
+                std::cerr << "无法打开临时文件: " << file << std::endl;
+                continue;
+            }
+
+            int64_t value;
+            if (input->read(reinterpret_cast<char*>(&value), sizeof(value))) {
+                std::lock_guard<std::mutex> lock(file_mutex_);  // 保护文件流的访问
+                heap.push({value, input});
+            } else {
+                std::cerr << "无法从临时文件读取: " << file << std::endl;
+            }
+            streams.push_back(input);
+        }
+
+        std::string merged_file = NewTempFile("merged");
+        DiskOutputFile output;
+        OpenUnbuffered(output, merged_file);
+        if (!output.is_open()) {
+            std::cerr << "无法打开合并文件: " << merged_file << std::endl;
+            return merged_file;
+        }
+        state.output_checksum = CHECKSUM_SEED;
+        if (final_merge && IndexEnabled()) {
+            index_builder_ = NewIndexBuilder(output_path_);
+        }
+
+        // 聚合模式下相同的键在堆中依次弹出，累计后再写出
+        bool has_pending = false;
+        int64_t pending_key = 0;
+        uint64_t pending_count = 0;
+        size_t written = 0;
+        while (!heap.empty()) {
+            auto [value, stream] = heap.top();
+            heap.pop();
+            uint64_t count = 1;
+            if (options_.mode == AggregateMode::kCount) {
+                stream->read(reinterpret_cast<char*>(&count), sizeof(count));
+            }
+
+            if (options_.mode == AggregateMode::kNone) {
+                WriteRecord(state, output, value, 1);
+                // 部分排序时写够 N 个键即可提前结束归并
+                if (++written == options_.limit) {
+                    break;
+                }
+            } else if (has_pending && value == pending_key) {
+                pending_count += count;
+                ++state.stats.collapsed_duplicates;
+            } else {
+                if (has_pending) {
+                    WriteRecord(state, output, pending_key, pending_count);
+                }
+                pending_key = value;
+                pending_count = count;
+                has_pending = true;
+            }
+
+            if (stream->read(reinterpret_cast<char*>(&value), sizeof(value))) {
+                heap.push({value, stream});
+            }
+        }
+        if (has_pending) {
+            WriteRecord(state, output, pending_key, pending_count);
+        }
+        FlushBuffer(state, output);
+        if (index_builder_) {
+            if (!index_builder_->Finish()) {
+                std::cerr << "无法写入索引文件: " << output_path_ << INDEX_SUFFIX << std::endl;
+            }
+            index_builder_.reset();
+        }
+
+        // 合并结果落盘并记录进清单之后，输入的归并段才可以删除
+        if (manifest_) {
+            manifest_->RecordMerge(FinishRun(state, output, merged_file), files);
+        }
+
+        // 合并完一个文件后，删除临时文件
+        RemoveRuns(files);
+
+        return merged_file;
+    }
+
+    // 分区输出：每个分区各自归并所有归并段中落在自己键范围内的部分，写到单独的文件，
+    // 多个分区同时归并，最后写出记录各分区键范围和记录数的清单。下游可以各读一个分区，不需要再查找边界
+    void MergePartitions(std::vector<std::string>& temp_files) {
+        // 每个分区的归并都要打开所有归并段，先把归并段归并到一次能打开的路数以内
+        size_t fan_in = MergeFanIn(memory_);
+        while (temp_files.size() > fan_in) {
+            std::vector<std::string> next_batch_files;
+            for (size_t i = 0; i < temp_files.size(); i += fan_in) {
+                size_t batch_end = std::min(i + fan_in, temp_files.size());
+                next_batch_files.push_back(
+                    MergeFiles(std::vector<std::string>(temp_files.begin() + i, temp_files.begin() + batch_end)));
+            }
+            temp_files = std::move(next_batch_files);
+            fan_in = MergeFanIn(memory_);
+        }
+
+        size_t count = options_.partitions;
+        std::vector<int64_t> splitters = options_.splitters;
+        if (splitters.empty() && count > 1) {
+            splitters = BalancedSplitters(temp_files, count);
+        }
+        partitions_.assign(count, PartitionInfo());
+        for (size_t p = 0; p < count; ++p) {
+            PartitionInfo& part = partitions_[p];
+            part.path = output_path_ + ".part" + std::to_string(p);
+            part.has_lower = p > 0;
+            part.lower = part.has_lower ? splitters[p - 1] : 0;
+            part.has_upper = p + 1 < count;
+            part.upper = part.has_upper ? splitters[p] : 0;
+        }
+
+        // 每个分区的归并需要一个写出缓存和每个归并段一个输入缓存，预算不够时少用几个线程
+        size_t min_merge = CACHE_SIZE + temp_files.size() * RecordSize();
+        size_t workers = std::min({count, MAX_PARTITION_WORKERS,
+                                   std::max<size_t>(std::thread::hardware_concurrency(), 1)});
+        while (workers > 1 && memory_.Available() / workers < min_merge) {
+            --workers;
+        }
+        size_t share = memory_.Available() / workers;
+        size_t stream_buffer = temp_files.empty() ? 0 : (share > CACHE_SIZE ? share - CACHE_SIZE : 0) / temp_files.size();
+        stream_buffer = std::min(stream_buffer, MERGE_STREAM_BUFFER) / RecordSize() * RecordSize();
+        stream_buffer = std::max<size_t>(stream_buffer, RecordSize());
+        stats_.partition_workers = workers;
+
+        std::atomic<size_t> next{0};
+        auto work = [&]() {
+            for (size_t p = next++; p < count; p = next++) {
+                MergePartition(temp_files, partitions_[p], stream_buffer);
+            }
+        };
+        std::vector<std::future<void>> helpers;
+        for (size_t w = 1; w < workers; ++w) {
+            helpers.push_back(std::async(std::launch::async, work));
+        }
+        work();
+        for (auto& helper : helpers) {
+            helper.get();
+        }
+
+        // 所有分区都写完之后再一起改名，下游看到清单时分区文件都已经就位
+        for (const auto& part : partitions_) {
+            std::filesystem::rename(part.path + ".tmp", part.path);
+        }
+        for (size_t p = count; std::filesystem::exists(output_path_ + ".part" + std::to_string(p)); ++p) {
+            std::filesystem::remove(output_path_ + ".part" + std::to_string(p)); // 上次分区更多时留下的文件
+        }
+        PrepareHash(output_path_, count);
+        WritePartitionManifest(output_path_ + PARTS_SUFFIX, partitions_);
+        PublishHash(output_path_, true);
+        // 上次不分区时留下的单个输出文件和它的索引，.sum 已经换成了分区的格式
+        std::filesystem::remove(output_path_);
+        std::filesystem::remove(output_path_ + INDEX_SUFFIX);
+        RemoveRuns(temp_files);
+        temp_files.clear();
+    }
+
+    // 按记录数均分的分割点：第 j 个分割点是全局第 total * j / count 条记录（从 0 开始）的键，
+    // 在键的取值范围上二分查找，每一步用各个归并段的二分查找统计不大于候选键的记录数。
+    // 重复很多的键不会被拆到两个分区，所以分区的大小可能不完全相等
+    std::vector<int64_t> BalancedSplitters(const std::vector<std::string>& files, size_t count) {
+        std::vector<std::unique_ptr<RunKeyReader>> runs;
+        uint64_t total = 0;
+        int64_t lowest = INT64_MAX;
+        int64_t highest = INT64_MIN;
+        for (const auto& file : files) {
+            runs.push_back(std::make_unique<RunKeyReader>(file, RecordSize()));
+            RunKeyReader& run = *runs.back();
+            if (run.Records() > 0) {
+                total += run.Records();
+                lowest = std::min(lowest, run.Key(0));
+                highest = std::max(highest, run.Key(run.Records() - 1));
+            }
+        }
+        if (total == 0) {
+            return std::vector<int64_t>(count - 1, 0); // 没有记录，所有分区都是空的
+        }
+
+        // 每个归并段中答案所在的记录序号区间随键的范围一起缩小，后面的二分查找只需在区间内进行，
+        // 取值范围缩小到几个键之后每步只读一两条记录
+        std::vector<int64_t> splitters;
+        std::vector<uint64_t> floor(runs.size(), 0);
+        for (size_t j = 1; j < count; ++j) {
+            uint64_t rank = total * j / count;
+            // 最小的 x，使得不大于 x 的记录数超过 rank
+            int64_t lo = splitters.empty() ? lowest : splitters.back();
+            int64_t hi = highest;
+            std::vector<uint64_t> first = floor;
+            std::vector<uint64_t> last(runs.size());
+            for (size_t r = 0; r < runs.size(); ++r) {
+                last[r] = runs[r]->Records();
+            }
+            std::vector<uint64_t> bounds(runs.size());
+            while (lo < hi) {
+                int64_t mid = static_cast<int64_t>(static_cast<uint64_t>(lo) +
+                                                   (static_cast<uint64_t>(hi) - static_cast<uint64_t>(lo)) / 2);
+                uint64_t at_most = 0;
+                for (size_t r = 0; r < runs.size(); ++r) {
+                    bounds[r] = runs[r]->Bound(mid, true, first[r], last[r]);
+                    at_most += bounds[r];
+                }
+                if (at_most > rank) {
+                    hi = mid;
+                    last = bounds;
+                } else {
+                    lo = mid + 1;
+                    first = bounds;
+                }
+            }
+            splitters.push_back(lo);
+            floor = first;
+        }
+        return splitters;
+    }
+
+    // 归并一个分区：每个归并段先二分查找定位到分区的下界，读到上界为止
+    void MergePartition(const std::vector<std::string>& files, PartitionInfo& part, size_t stream_buffer) {
+        WorkerState state(memory_, CACHE_SIZE);
+        MemoryReservation stream_memory(memory_, stream_buffer * files.size(), "归并输入缓存");
+        std::vector<std::unique_ptr<char[]>> stream_buffers;
+        std::vector<std::unique_ptr<DiskInputFile>> streams;
+        using HeapItem = std::pair<int64_t, size_t>;
+        std::priority_queue<HeapItem, std::vector<HeapItem>, std::greater<HeapItem>> heap;
+        auto in_range = [&part](int64_t key) { return !part.has_upper || key < part.upper; };
+
+        for (const auto& file : files) {
+            stream_buffers.push_back(std::make_unique<char[]>(stream_buffer));
+            streams.push_back(std::make_unique<DiskInputFile>());
+            DiskInputFile& input = *streams.back();
+            input.rdbuf()->pubsetbuf(stream_buffers.back().get(), stream_buffer);
+            input.open(file, std::ios::binary);
+            if (!input.is_open()) {
+                throw std::runtime_error("无法打开临时文件: " + file);
+            }
+            if (part.has_lower) {
+                uint64_t first = RunKeyReader(file, RecordSize()).Bound(part.lower, false);
+                input.seekg(first * RecordSize());
+            }
+            int64_t value;
+            if (input.read(reinterpret_cast<char*>(&value), sizeof(value)) && in_range(value)) {
+                heap.push({value, streams.size() - 1});
+            }
+        }
+
+        DiskOutputFile output;
+        OpenUnbuffered(output, part.path + ".tmp");
+        if (!output.is_open()) {
+            throw std::runtime_error("无法创建分区文件: " + part.path);
+        }
+        // 相同的键都在同一个分区里，聚合与 MergeFiles 相同
+        bool has_pending = false;
+        int64_t pending_key = 0;
+        uint64_t pending_count = 0;
+        auto emit = [&](int64_t key, uint64_t count) {
+            WriteRecord(state, output, key, count);
+            part.min_key = part.records == 0 ? key : part.min_key;
+            part.max_key = key;
+            ++part.records;
+        };
+        while (!heap.empty()) {
+            auto [value, index] = heap.top();
+            heap.pop();
+            DiskInputFile& input = *streams[index];
+            uint64_t count = 1;
+            if (options_.mode == AggregateMode::kCount) {
+                input.read(reinterpret_cast<char*>(&count), sizeof(count));
+            }
+            if (options_.mode == AggregateMode::kNone) {
+                emit(value, 1);
+            } else if (has_pending && value == pending_key) {
+                pending_count += count;
+                ++state.stats.collapsed_duplicates;
+            } else {
+                if (has_pending) {
+                    emit(pending_key, pending_count);
+                }
+                pending_key = value;
+                pending_count = count;
+                has_pending = true;
+            }
+            if (input.read(reinterpret_cast<char*>(&value), sizeof(value)) && in_range(value)) {
+                heap.push({value, index});
+            }
+        }
+        if (has_pending) {
+            emit(pending_key, pending_count);
+        }
+        FlushBuffer(state, output);
+        output.close();
+        if (!output) {
+            throw std::runtime_error("无法写入分区文件: " + part.path);
+        }
+
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        stats_.Add(state.stats);
+    }
+
+    // 规划器：输入都是二进制文件、不需要增量合并、断点续排和前 K 个时才能使用分布排序；
+    // 自动选择时，只有当归并需要不止一趟、而分布排序两趟就能完成时才选择它
+    bool ChooseBucketEngine(const std::vector<std::string>& input_files) {
+        if (options_.engine == SortEngine::kMerge || options_.text_input || options_.incremental ||
+            !options_.job_id.empty() || options_.numa || options_.limit > 0 || options_.partitions > 0) {
+            return false;
+        }
+        if (options_.engine == SortEngine::kBucket) {
+            return true;
+        }
+        BucketPlan plan = PlanBuckets(CountInputKeys(input_files));
+        uint64_t runs = (plan.total_keys + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        return plan.two_pass && runs > MergeFanIn(memory_);
+    }
+
+    uint64_t CountInputKeys(const std::vector<std::string>& input_files) const {
+        uint64_t total = 0;
+        for (const auto& file : input_files) {
+            std::error_code ec;
+            uintmax_t size = std::filesystem::file_size(file, ec);
+            if (!ec) {
+                total += size / sizeof(int64_t);
+            }
+        }
+        return total;
+    }
+
+    // 可用预算在并行排序的线程间平分，得到每个桶的容量；
+    // 抽样得到的桶大小有误差，按容量的 3/4 确定桶数
+    BucketPlan PlanBuckets(uint64_t total_keys) {
+        BucketPlan plan;
+        plan.total_keys = total_keys;
+        size_t available = memory_.Available();
+        plan.workers = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), MAX_BUCKET_WORKERS));
+        while (plan.workers > 1 && available / plan.workers < MIN_BLOCK_KEYS * sizeof(int64_t)) {
+            --plan.workers;
+        }
+        plan.bucket_keys = std::max<size_t>(available / plan.workers / sizeof(int64_t), 1);
+        uint64_t planned_keys = std::max<uint64_t>(plan.bucket_keys * 3 / 4, 1);
+        uint64_t wanted = (total_keys + planned_keys - 1) / planned_keys;
+        size_t max_buckets = MaxBuckets();
+        plan.bucket_count = static_cast<size_t>(std::min<uint64_t>(std::max<uint64_t>(wanted, 1), max_buckets));
+        plan.two_pass = wanted <= max_buckets;
+        return plan;
+    }
+
+    // 每个桶至少要有一个缓存行的写合并缓存，另一半预算留给读入的数据
+    size_t MaxBuckets() {
+        return std::max<size_t>(1, std::min(MAX_BUCKETS, memory_.Available() / 2 / (MIN_WC_KEYS * sizeof(int64_t))));
+    }
+
+    // 分布排序：按抽样得到的分割点把所有输入分到键范围互不重叠的桶中，再按顺序排序每个桶并追加到输出。
+    // 每个桶都能放进内存时，每个键只读写两次；超出容量的桶再拆分一次
+    void DistributionSort(const std::vector<std::string>& input_files) {
+        WorkerState& state = main_state_;
+        state.stats.bucket_engine = true;
+        MemoryReservation index_memory(memory_, IndexMemory(), "索引缓存"); // 先于分桶计划登记
+        BucketPlan plan = PlanBuckets(CountInputKeys(input_files));
+
+        std::vector<int64_t> splitters = SampleSplitters(input_files, plan.bucket_count, INT64_MIN, INT64_MAX, true);
+        std::vector<Bucket> buckets = Partition(input_files, splitters, true);
+
+        std::string merged_file = NewTempFile("merged");
+        DiskOutputFile output;
+        OpenUnbuffered(output, merged_file);
+        if (!output.is_open()) {
+            std::cerr << "无法打开合并文件: " << merged_file << std::endl;
+            return;
+        }
+        state.output_checksum = CHECKSUM_SEED;
+        if (IndexEnabled()) {
+            index_builder_ = NewIndexBuilder(output_path_);
+        }
+        SortBuckets(buckets, output, plan);
+        FlushBuffer(state, output);
+        output.close();
+        state.stats.io_write_bytes += std::filesystem::file_size(merged_file);
+        if (index_builder_) {
+            if (!index_builder_->Finish()) {
+                std::cerr << "无法写入索引文件: " << output_path_ << INDEX_SUFFIX << std::endl;
+            }
+            index_builder_.reset();
+        }
+
+        PrepareHash(output_path_);
+        std::filesystem::rename(merged_file, output_path_);
+        PublishIndex(output_path_, true);
+        PublishHash(output_path_, true);
+    }
+
+    // 从文件中均匀地随机抽取键（每个样本一次 pread），排序后取分位点作为分割点。
+    // 小于分割点的键分到左边，所以只保留落在 (min_key, max_key] 中的分割点，这样每个分割点都能把这个范围分开；
+    // 一个也没有而范围内又不止一个值时，用范围的中点分割，保证递归拆分总能前进
+    std::vector<int64_t> SampleSplitters(const std::vector<std::string>& files, size_t bucket_count,
+                                         int64_t min_key, int64_t max_key, bool ingest) {
+        std::vector<int64_t> splitters;
+        if (bucket_count > 1) {
+            std::vector<uint64_t> offsets; // 每个文件第一个键在全部键中的序号
+            uint64_t total = 0;
+            for (const auto& file : files) {
+                offsets.push_back(total);
+                std::error_code ec;
+                uintmax_t size = std::filesystem::file_size(file, ec);
+                total += ec ? 0 : size / sizeof(int64_t);
+            }
+
+            size_t sample_count = std::min<uint64_t>(bucket_count * SAMPLES_PER_BUCKET, total);
+            sample_count = std::min(sample_count, memory_.Available() / sizeof(int64_t));
+            MemoryReservation sample_memory(memory_, sample_count * sizeof(int64_t), "抽样缓存");
+            std::vector<int64_t> samples;
+            samples.reserve(sample_count);
+            std::mt19937_64 random(total);
+            std::vector<int> fds;
+            std::vector<SimulatedDisk*> disks;
+            for (const auto& file : files) {
+                fds.push_back(::open(file.c_str(), O_RDONLY));
+                disks.push_back(DiskSimulator::Instance().Find(file));
+            }
+            for (size_t i = 0; i < sample_count; ++i) {
+                uint64_t index = random() % total;
+                size_t f = std::upper_bound(offsets.begin(), offsets.end(), index) - offsets.begin() - 1;
+                int64_t key;
+                uint64_t offset = (index - offsets[f]) * sizeof(key);
+                if (fds[f] >= 0 && ::pread(fds[f], &key, sizeof(key), offset) == static_cast<ssize_t>(sizeof(key))) {
+                    samples.push_back(key);
+                    if (disks[f]) {
+                        disks[f]->Transfer(&fds[f], offset, sizeof(key), false);
+                    }
+                }
+            }
+            for (int fd : fds) {
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+            }
+            main_state_.stats.io_read_bytes += samples.size() * sizeof(int64_t);
+            if (ingest) {
+                samples.resize(FilterKeys(samples.data(), samples.size()));
+            }
+
+            // 一个值占了超过一个桶的样本时，它是重复很多的热点键，在它两侧各放一个分割点，
+            // 让它单独成为一个所有键都相同的桶，写出时不必读入和排序
+            std::sort(samples.begin(), samples.end());
+            size_t max_splitters = MaxBuckets() - 1;
+            for (size_t b = 1; b < bucket_count && !samples.empty(); ++b) {
+                int64_t splitter = samples[b * samples.size() / bucket_count];
+                if (splitter > min_key && splitter <= max_key && (splitters.empty() || splitter > splitters.back())) {
+                    splitters.push_back(splitter);
+                    auto run = std::equal_range(samples.begin(), samples.end(), splitter);
+                    if (static_cast<size_t>(run.second - run.first) * bucket_count >= samples.size() &&
+                        splitter < max_key && splitters.size() < max_splitters) {
+                        splitters.push_back(splitter + 1);
+                    }
+                }
+            }
+        }
+        if (splitters.empty() && !ingest && min_key < max_key) {
+            // 全部在 uint64_t 中计算，最后转换一次，键的范围覆盖整个 int64_t 时也不会溢出
+            splitters.push_back(static_cast<int64_t>(static_cast<uint64_t>(min_key) +
+                                                     (static_cast<uint64_t>(max_key) - static_cast<uint64_t>(min_key)) / 2 + 1));
+        }
+        return splitters;
+    }
+
+    // 按分割点把键分到各个桶。每个桶有一段按缓存行对齐的写合并缓存，攒满后整段写到桶文件，
+    // 避免在大量桶文件之间零碎地写入，也让分桶的内层循环只访问少量连续的缓存行。
+    // ingest 为 true 时读取的是原始输入，同时做范围过滤并计算输入哈希
+    std::vector<Bucket> Partition(const std::vector<std::string>& files, const std::vector<int64_t>& splitters,
+                                  bool ingest) {
+        WorkerState& state = main_state_;
+        size_t bucket_count = splitters.size() + 1;
+        size_t available = memory_.Available();
+        size_t wc_keys = available / 2 / bucket_count / sizeof(int64_t) / MIN_WC_KEYS * MIN_WC_KEYS;
+        wc_keys = std::min(std::max(wc_keys, MIN_WC_KEYS), MAX_WC_KEYS);
+        size_t wc_bytes = bucket_count * wc_keys * sizeof(int64_t);
+        MemoryReservation wc_memory(memory_, wc_bytes, "写合并缓存");
+        std::unique_ptr<int64_t, decltype(&std::free)> combine(
+            static_cast<int64_t*>(std::aligned_alloc(64, wc_bytes)), &std::free);
+        std::vector<size_t> fill(bucket_count, 0);
+
+        size_t read_keys = std::min(READ_STEP_KEYS, std::max(memory_.Available() / sizeof(int64_t), MIN_BLOCK_KEYS));
+        MemoryReservation read_memory(memory_, read_keys * sizeof(int64_t), "分桶读入缓存");
+        std::vector<int64_t> chunk;
+        chunk.reserve(read_keys);
+
+        std::vector<Bucket> buckets(bucket_count);
+        std::vector<DiskOutputFile> outputs(bucket_count);
+        for (size_t b = 0; b < bucket_count; ++b) {
+            buckets[b].path = NewTempFile("bucket");
+            OpenUnbuffered(outputs[b], buckets[b].path);
+            if (!outputs[b].is_open()) {
+                throw std::runtime_error("无法打开桶文件: " + buckets[b].path);
+            }
+        }
+
+        auto flush = [&](size_t b) {
+            const int64_t* keys = combine.get() + b * wc_keys;
+            Bucket& bucket = buckets[b];
+            for (size_t i = 0; i < fill[b]; ++i) {
+                bucket.min_key = std::min(bucket.min_key, keys[i]);
+                bucket.max_key = std::max(bucket.max_key, keys[i]);
+            }
+            outputs[b].write(reinterpret_cast<const char*>(keys), fill[b] * sizeof(int64_t));
+            bucket.count += fill[b];
+            state.stats.io_write_bytes += fill[b] * sizeof(int64_t);
+            fill[b] = 0;
+        };
+
+        SortOptions raw; // 桶文件总是二进制格式，不再过滤
+        for (const auto& file : files) {
+            KeySource input(file, ingest ? options_ : raw, memory_);
+            if (!input.IsOpen()) {
+                std::cerr << "无法打开文件: " << file << std::endl;
+                continue;
+            }
+            state.input_hash = MultisetHash();
+            bool more = true;
+            while (more) {
+                chunk.clear();
+                uint64_t scanned = state.stats.scanned_keys;
+                if (ingest) {
+                    // 范围过滤掉的键也从磁盘读过，按读到的键数而不是保留的键数统计
+                    more = ReadKeys(state, input, chunk, read_keys);
+                    scanned = state.stats.scanned_keys - scanned;
+                } else {
+                    chunk.resize(read_keys);
+                    chunk.resize(input.Read(chunk.data(), read_keys));
+                    more = chunk.size() == read_keys;
+                    scanned = chunk.size();
+                }
+                state.stats.io_read_bytes += scanned * sizeof(int64_t);
+                for (int64_t key : chunk) {
+                    size_t b = FindBucket(splitters, key);
+                    combine.get()[b * wc_keys + fill[b]] = key;
+                    if (++fill[b] == wc_keys) {
+                        flush(b);
+                    }
+                }
+            }
+            if (ingest) {
+                ingest_hash_.Merge(state.input_hash);
+            }
+        }
+        for (size_t b = 0; b < bucket_count; ++b) {
+            flush(b);
+            outputs[b].close();
+        }
+        return buckets;
+    }
+
+    // 读入一个桶并排序，在工作线程中执行；内存在读入之前登记，写出之后随返回值一起释放
+    struct SortedBucket {
+        std::unique_ptr<MemoryReservation> memory;
+        std::vector<int64_t> keys;
+    };
+
+    SortedBucket LoadAndSortBucket(const Bucket& bucket) {
+        SortedBucket sorted;
+        sorted.memory = std::make_unique<MemoryReservation>(memory_, bucket.count * sizeof(int64_t), "桶");
+        sorted.keys.resize(bucket.count);
+        DiskInputFile input;
+        OpenUnbuffered(input, bucket.path);
+        input.read(reinterpret_cast<char*>(sorted.keys.data()), bucket.count * sizeof(int64_t));
+        sorted.keys.resize(input.gcount() / sizeof(int64_t));
+        input.close();
+        std::filesystem::remove(bucket.path);
+        std::sort(sorted.keys.begin(), sorted.keys.end(), [this](int64_t a, int64_t b) { return Before(a, b); });
+        return sorted;
+    }
+
+    // 按桶的顺序输出。能放进内存的桶交给最多 plan.workers 个线程并行读入和排序，再按顺序写出；
+    // 所有键都相同的桶不必读入，直接写出；超出容量的桶（抽样误差或数据倾斜）再次抽样拆分后递归处理
+    void SortBuckets(std::vector<Bucket>& buckets, DiskOutputFile& output, const BucketPlan& plan) {
+        WorkerState& state = main_state_;
+        std::deque<std::future<SortedBucket>> window;
+        auto write_front = [&]() {
+            SortedBucket sorted = window.front().get();
+            window.pop_front();
+            state.stats.io_read_bytes += sorted.keys.size() * sizeof(int64_t);
+            ++state.stats.buckets_sorted;
+            WriteSortedKeys(state, output, sorted.keys);
+        };
+
+        for (size_t n = 0; n < buckets.size(); ++n) {
+            const Bucket& bucket = buckets[options_.descending ? buckets.size() - 1 - n : n];
+            if (bucket.count == 0) {
+                std::filesystem::remove(bucket.path);
+                continue;
+            }
+            if (bucket.min_key == bucket.max_key || bucket.count > plan.bucket_keys) {
+                while (!window.empty()) {
+                    write_front();
+                }
+                if (bucket.min_key == bucket.max_key) {
+                    WriteUniformBucket(state, output, bucket);
+                } else {
+                    SplitBucket(bucket, output, plan);
+                }
+                continue;
+            }
+            if (window.size() == plan.workers) {
+                write_front();
+            }
+            window.push_back(std::async(std::launch::async, [this, bucket]() { return LoadAndSortBucket(bucket); }));
+        }
+        while (!window.empty()) {
+            write_front();
+        }
+    }
+
+    void WriteSortedKeys(WorkerState& state, DiskOutputFile& output, const std::vector<int64_t>& keys) {
+        for (size_t i = 0; i < keys.size();) {
+            size_t j = i + 1;
+            if (options_.mode != AggregateMode::kNone) {
+                while (j < keys.size() && keys[j] == keys[i]) {
+                    ++j;
+                }
+                state.stats.collapsed_duplicates += j - i - 1;
+            }
+            WriteRecord(state, output, keys[i], j - i);
+            i = j;
+        }
+    }
+
+    void WriteUniformBucket(WorkerState& state, DiskOutputFile& output, const Bucket& bucket) {
+        ++state.stats.uniform_buckets;
+        if (options_.mode == AggregateMode::kNone) {
+            for (uint64_t i = 0; i < bucket.count; ++i) {
+                WriteRecord(state, output, bucket.min_key, 1);
+            }
+        } else {
+            WriteRecord(state, output, bucket.min_key, bucket.count);
+            state.stats.collapsed_duplicates += bucket.count - 1;
+        }
+        std::filesystem::remove(bucket.path);
+    }
+
+    void SplitBucket(const Bucket& bucket, DiskOutputFile& output, const BucketPlan& plan) {
+        ++main_state_.stats.bucket_splits;
+        uint64_t planned_keys = std::max<uint64_t>(plan.bucket_keys * 3 / 4, 1);
+        size_t bucket_count = static_cast<size_t>(
+            std::min<uint64_t>((bucket.count + planned_keys - 1) / planned_keys, MaxBuckets()));
+        std::vector<int64_t> splitters =
+            SampleSplitters({bucket.path}, std::max<size_t>(bucket_count, 2), bucket.min_key, bucket.max_key, false);
+        std::vector<Bucket> parts = Partition({bucket.path}, splitters, false);
+        std::filesystem::remove(bucket.path);
+        SortBuckets(parts, output, plan);
+    }
+
+    void Cleanup(const std::vector<std::string>& temp_files) {
+        RemoveRuns(temp_files);
+    }
+
+    // 删除归并段文件，跳过直接引用的输入文件和增量模式下已有的输出
+    void RemoveRuns(const std::vector<std::string>& files) {
+        for (const auto& file : files) {
+            if (!borrowed_runs_.count(file)) {
+                std::filesystem::remove(file);
+            }
+        }
+    }
+};
+
+// 字符串排序的统计信息
+struct StringSortStats {
+    uint64_t keys = 0; // 读入的行数
+    size_t runs = 0; // 生成的归并段数
+    size_t merge_passes = 0; // 归并的趟数
+    uint64_t radix_passes = 0; // 基数排序分桶时搬动数据的次数
+    uint64_t tie_compares = 0; // 前缀相同、需要比较后续字节的次数（块内排序和归并）
+    uint64_t collapsed_duplicates = 0; // 去重模式下丢弃的重复行数
+};
+
+// 按行分隔的变长字符串的外部排序（--strings）。
+// 每个数据块是一个 StringBlock，块内用规范化前缀做 MSD 基数排序，写成长度前缀格式的归并段；
+// 归并时堆中比较的也是每个输入流当前键的前缀，相同时才比较完整的键。最终输出每行一个字符串
+class StringSorter {
+public:
+    StringSorter(const std::string& output_path, const SortOptions& options = SortOptions())
+        : output_path_(output_path), options_(options), memory_(options.memory_limit, DEFAULT_MEMORY_BUDGET),
+          state_(memory_, CACHE_SIZE) {}
+
+    void Sort(const std::vector<std::string>& input_files) {
+        std::vector<std::string> runs;
+        {
+            MemoryReservation read_memory(memory_, CACHE_SIZE, "字符串读取缓存");
+            std::vector<char> chunk(CACHE_SIZE);
+            // 数据块占用其余的全部预算，块内的键越多，归并段越少
+            size_t block_bytes = memory_.Available();
+            MemoryReservation block_memory(memory_, block_bytes, "字符串数据块");
+            StringBlock block(block_bytes);
+            for (const auto& file_path : input_files) {
+                ProcessFile(file_path, chunk, block, runs);
+            }
+            if (block.Count() > 0) {
+                WriteRun(block, runs);
+            }
+        }
+        MergeRuns(runs);
+        // 替换掉整数排序留下的 .sum，校验程序和增量模式不会把文本输出当作整数记录读取
+        SumInfo info;
+        info.mode = "strings";
+        info.record_size = 0;
+        if (!WriteSumFile(output_path_ + SUM_SUFFIX, info)) {
+            std::cerr << "无法写入哈希文件: " << output_path_ << SUM_SUFFIX << std::endl;
+        }
+        // 文本输出没有索引，整数排序留下的索引与它不一致
+        std::filesystem::remove(output_path_ + INDEX_SUFFIX);
+    }
+
+    const StringSortStats& GetStats() const { return stats_; }
+    const MemoryBudget& GetMemoryBudget() const { return memory_; }
+
+private:
+    std::string output_path_;
+    SortOptions options_;
+    MemoryBudget memory_;
+    WorkerState state_; // 写出缓存
+    StringSortStats stats_;
+
+    size_t temp_counter_ = 0;
+    size_t max_key_bytes_ = 0; // 归并段中最长的键，归并时每一路都要为它留出内存
+
+    // 大文件的归并段可能有几万个，随机数命名会重复，用进程号加编号
+    std::string NewTempFile(const std::string& prefix) {
+        std::filesystem::create_directory("temp_sort");
+        return "temp_sort/" + prefix + "_" + std::to_string(::getpid()) + "_" + std::to_string(temp_counter_++) + ".bin";
+    }
+
+    // 按块读入文件，逐行追加到数据块；数据块满时先排序写出，跨块的行留在新块的开头
+    void ProcessFile(const std::string& file_path, std::vector<char>& chunk, StringBlock& block,
+                     std::vector<std::string>& runs) {
+        DiskInputFile input;
+        OpenUnbuffered(input, file_path);
+        if (!input.is_open()) {
+            std::cerr << "无法打开文件: " << file_path << std::endl;
+            return;
+        }
+        bool open_record = false; // 上一块末尾有不完整的行
+        while (input.read(chunk.data(), chunk.size()) || input.gcount() > 0) {
+            const char* p = chunk.data();
+            const char* end = p + input.gcount();
+            while (p != end) {
+                const char* newline = FindByte(p, end, '\n');
+                AppendToBlock(block, p, newline - p, runs);
+                open_record = newline == end;
+                if (!open_record) {
+                    EndRecord(block, runs);
+                    ++newline;
+                }
+                p = newline;
+            }
+        }
+        // 最后一行没有换行符
+        if (open_record) {
+            EndRecord(block, runs);
+        }
+    }
+
+    void AppendToBlock(StringBlock& block, const char* data, size_t size, std::vector<std::string>& runs) {
+        if (block.Append(data, size)) {
+            return;
+        }
+        if (block.Count() > 0) {
+            WriteRun(block, runs);
+            block.Clear();
+            if (block.Append(data, size)) {
+                return;
+            }
+        }
+        throw std::runtime_error("行太长，超出内存预算 (数据块 " + std::to_string(block.Capacity()) + " 字节)");
+    }
+
+    void EndRecord(StringBlock& block, std::vector<std::string>& runs) {
+        if (!block.EndRecord()) {
+            WriteRun(block, runs);
+            block.Clear();
+            if (!block.EndRecord()) {
+                throw std::runtime_error("行太长，超出内存预算 (数据块 " + std::to_string(block.Capacity()) + " 字节)");
+            }
+        }
+        ++stats_.keys;
+    }
+
+    // 排序数据块中已经结束的键，写成一个归并段
+    void WriteRun(StringBlock& block, std::vector<std::string>& runs) {
+        StringRadixSorter sorter(block.Arena());
+        StringRef* refs = block.Refs();
+        size_t count = block.Count();
+        sorter.Sort(refs, count, block.Scratch());
+        stats_.radix_passes += sorter.Passes();
+        stats_.tie_compares += sorter.TieCompares();
+
+        std::string path = NewTempFile("strings");
+        DiskOutputFile output;
+        OpenUnbuffered(output, path);
+        if (!output.is_open()) {
+            throw std::runtime_error("无法创建临时文件: " + path);
+        }
+        const char* arena = block.Arena();
+        for (size_t i = 0; i < count; ++i) {
+            const char* key = arena + refs[i].offset;
+            max_key_bytes_ = std::max<size_t>(max_key_bytes_, refs[i].length);
+            if (options_.mode == AggregateMode::kDistinct && i > 0 &&
+                CompareFrom(key, refs[i].length, arena + refs[i - 1].offset, refs[i - 1].length, 0) == 0) {
+                ++stats_.collapsed_duplicates;
+                continue;
+            }
+            WriteKey(output, key, refs[i].length, false);
+        }
+        FlushBuffer(output);
+        output.close();
+        runs.push_back(path);
+        ++stats_.runs;
+    }
+
+    // 归并段中的键带 uint32 长度，最终输出中的键后面跟换行符
+    void WriteKey(DiskOutputFile& output, const char* key, size_t length, bool text) {
+        uint32_t size = static_cast<uint32_t>(length);
+        if (!text) {
+            BufferedWrite(output, &size, sizeof(size));
+        }
+        BufferedWrite(output, key, length);
+        if (text) {
+            BufferedWrite(output, "\n", 1);
+        }
+    }
+
+    // 比缓存还大的键直接写出
+    void BufferedWrite(DiskOutputFile& output, const void* data, size_t size) {
+        if (!state_.buffer.Write(data, size)) {
+            FlushBuffer(output);
+            if (!state_.buffer.Write(data, size)) {
+                output.write(static_cast<const char*>(data), size);
+            }
+        }
+    }
+
+    void FlushBuffer(DiskOutputFile& output) {
+        if (!state_.buffer.IsEmpty()) {
+            output.write(state_.buffer.GetBuffer(), state_.buffer.GetWritePos());
+            state_.buffer.Reset();
+        }
+    }
+
+    void MergeRuns(std::vector<std::string>& runs) {
+        if (runs.empty()) {
+            std::ofstream output(output_path_, std::ios::binary | std::ios::trunc);
+            return;
+        }
+        size_t fan_in = FanIn();
+        while (runs.size() > fan_in) {
+            std::vector<std::string> next;
+            for (size_t i = 0; i < runs.size(); i += fan_in) {
+                size_t batch_end = std::min(i + fan_in, runs.size());
+                next.push_back(MergeFiles(std::vector<std::string>(runs.begin() + i, runs.begin() + batch_end), false));
+            }
+            runs = std::move(next);
+            ++stats_.merge_passes;
+            fan_in = FanIn();
+        }
+        std::string merged = MergeFiles(runs, true);
+        ++stats_.merge_passes;
+        std::filesystem::rename(merged, output_path_);
+    }
+
+    // 与 MergeFanIn 相同，但每一路除了输入缓存还要放下一个最长的键，去重时另有一个上一个键的副本
+    size_t FanIn() {
+        size_t available = static_cast<size_t>(memory_.Available() * memory_.Scale());
+        available -= std::min(available, max_key_bytes_);
+        size_t streams = available / (MERGE_STREAM_BUFFER + max_key_bytes_);
+        return std::min(std::max<size_t>(streams, 2), MAX_MERGE_FAN_IN);
+    }
+
+    // 每个输入流的当前键留在它的 StringRunReader 中，按最长的键登记在预算里，
+    // 堆中只放流的编号，比较时先比较前缀
+    std::string MergeFiles(const std::vector<std::string>& files, bool final_merge) {
+        bool distinct = options_.mode == AggregateMode::kDistinct;
+        MemoryReservation key_memory(memory_, (files.size() + distinct) * max_key_bytes_, "归并键缓存");
+        size_t stream_buffer = std::min(MERGE_STREAM_BUFFER, memory_.Available() / files.size());
+        stream_buffer = std::max<size_t>(stream_buffer, sizeof(uint32_t));
+        MemoryReservation stream_memory(memory_, stream_buffer * files.size(), "归并输入缓存");
+        std::vector<std::unique_ptr<char[]>> stream_buffers;
+        std::vector<std::unique_ptr<DiskInputFile>> streams;
+        std::vector<std::unique_ptr<StringRunReader>> readers;
+        for (const auto& file : files) {
+            stream_buffers.push_back(std::make_unique<char[]>(stream_buffer));
+            streams.push_back(std::make_unique<DiskInputFile>());
+            streams.back()->rdbuf()->pubsetbuf(stream_buffers.back().get(), stream_buffer);
+            streams.back()->open(file, std::ios::binary);
+            if (!streams.back()->is_open()) {
+                throw std::runtime_error("无法打开临时文件: " + file);
+            }
+            readers.push_back(std::make_unique<StringRunReader>(*streams.back(), max_key_bytes_));
+        }
+
+        auto later = [this, &readers](size_t a, size_t b) {
+            const StringRunReader& x = *readers[a];
+            const StringRunReader& y = *readers[b];
+            if (x.Prefix() != y.Prefix()) {
+                return x.Prefix() > y.Prefix();
+            }
+            ++stats_.tie_compares;
+            return CompareFrom(x.Key().data(), x.Key().size(), y.Key().data(), y.Key().size(), STRING_PREFIX_BYTES) > 0;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+        for (size_t i = 0; i < readers.size(); ++i) {
+            if (readers[i]->Next()) {
+                heap.push(i);
+            }
+        }
+
+        std::string merged_file = NewTempFile("strings_merged");
+        DiskOutputFile output;
+        OpenUnbuffered(output, merged_file);
+        if (!output.is_open()) {
+            throw std::runtime_error("无法打开合并文件: " + merged_file);
+        }
+        std::string last;
+        last.reserve(distinct ? max_key_bytes_ : 0);
+        bool has_last = false;
+        while (!heap.empty()) {
+            size_t top = heap.top();
+            heap.pop();
+            const std::string& key = readers[top]->Key();
+            if (distinct && has_last && key == last) {
+                ++stats_.collapsed_duplicates;
+            } else {
+                WriteKey(output, key.data(), key.size(), final_merge);
+                if (distinct) {
+                    last = key;
+                    has_last = true;
+                }
+            }
+            if (readers[top]->Next()) {
+                heap.push(top);
+            }
+        }
+        FlushBuffer(output);
+        output.close();
+        for (const auto& file : files) {
+            std::filesystem::remove(file);
+        }
+        return merged_file;
+    }
+};
+
+// 各模拟磁盘的读写统计，没有配置模拟磁盘时不输出
+void PrintDiskReport(double elapsed) {
+    for (const auto& disk : DiskSimulator::Instance().Disks()) {
+        // 服务时间之和除以排序耗时是平均同时在处理的请求数，等待时间之和除以排序耗时是平均阻塞在这块磁盘上的线程数
+        DiskStats io = disk->Stats();
+        std::cout << "模拟磁盘 " << disk->Dir() << "（" << disk->Profile().name << "）: 读 " << io.reads << " 次 "
+                  << io.read_bytes << " 字节，写 " << io.writes << " 次 " << io.write_bytes << " 字节，寻道 " << io.seeks
+                  << " 次，平均并发请求 " << io.service_seconds / elapsed << "，平均阻塞线程 "
+                  << io.wait_seconds / elapsed << std::endl;
+    }
+    if (DiskSimulator::Instance().Enabled()) {
+        std::cout << "排序耗时 " << elapsed << " 秒" << std::endl;
+    }
+}
+
+// --strings 模式：排序按行分隔的字符串文件
+int SortStrings(const std::string& output_file, const SortOptions& options, const std::vector<std::string>& input_files) {
+    StringSorter sorter(output_file, options);
+    auto start = std::chrono::steady_clock::now();
+    try {
+        sorter.Sort(input_files);
+    } catch (const std::exception& e) {
+        std::cerr << "排序失败: " << e.what() << std::endl;
+        return -1;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const StringSortStats& stats = sorter.GetStats();
+    const MemoryBudget& memory = sorter.GetMemoryBudget();
     std::cout << "排序完成，结果保存为 " << output_file << std::endl;
+    std::cout << "字符串排序: " << stats.keys << " 行，归并段 " << stats.runs << " 个，归并 " << stats.merge_passes
+              << " 趟，基数排序分桶 " << stats.radix_passes << " 次，前缀相同时比较完整键 " << stats.tie_compares
+              << " 次，合并的重复行: " << stats.collapsed_duplicates << std::endl;
+    std::cout << "内存预算: " << memory.Limit() << " 字节" << (memory.CgroupLimited() ? "（受 cgroup 限制）" : "")
+              << "，峰值 " << memory.Peak() << " 字节" << std::endl;
+    PrintDiskReport(elapsed);
+    return 0;
+}
+
+// 分布式排序中工作进程建立连接时先发送的握手消息，后面跟着 sample_count 个样本
+struct DistHello {
+    uint32_t rank;
+    uint32_t sample_count;
+    uint64_t total_keys; // 发送方输入中通过范围过滤的键数的估计，每个样本代表 total_keys / sample_count 个键
+};
+
+// 工作进程结束时通过管道交给父进程的报告
+struct DistReport {
+    uint64_t input_keys; // 分到的输入文件中的键数
+    uint64_t local_records; // 本地排序后的记录数，也就是发出的记录数
+    uint64_t records; // 输出分区的记录数
+    int64_t min_key; // records > 0 时有效
+    int64_t max_key;
+    bool has_lower;
+    int64_t lower;
+    bool has_upper;
+    int64_t upper;
+    uint64_t bytes_sent;
+    uint64_t bytes_remote; // 发往其他进程的字节数
+    uint64_t bytes_received;
+    double sort_seconds; // 抽样和本地排序
+    double shuffle_seconds; // 洗牌和归并收到的数据
+};
+
+// 分布式排序的一个工作进程：排序分到的输入文件，与所有进程交换样本得到相同的全局分割点，
+// 本地结果按分割点输出成与进程数相同的分区，第 j 个分区发给第 j 个进程；
+// 每个进程一边接收一边归并，得到全局有序结果中自己负责的那个键范围
+class DistributedWorker {
+public:
+    DistributedWorker(size_t rank, const std::vector<std::string>& addresses, int listen_fd,
+                      const std::string& output_path, const std::string& local_path, const SortOptions& options)
+        : rank_(rank), workers_(addresses.size()), addresses_(addresses), listen_fd_(listen_fd),
+          output_path_(output_path), local_path_(local_path), options_(options),
+          memory_(options.memory_limit, DEFAULT_MEMORY_BUDGET), outgoing_(workers_, -1), incoming_(workers_, -1),
+          report_() {}
+
+    DistributedWorker(const DistributedWorker&) = delete;
+    DistributedWorker& operator=(const DistributedWorker&) = delete;
+
+    ~DistributedWorker() {
+        for (int fd : outgoing_) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        for (int fd : incoming_) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        for (size_t j = 0; j < workers_; ++j) {
+            std::filesystem::remove(local_path_ + ".part" + std::to_string(j));
+        }
+        std::filesystem::remove(local_path_ + PARTS_SUFFIX);
+    }
+
+    DistReport Run(const std::vector<std::string>& input_files) {
+        auto start = std::chrono::steady_clock::now();
+        splitters_ = ExchangeSamples(input_files);
+        report_.has_lower = rank_ > 0;
+        report_.lower = report_.has_lower ? splitters_[rank_ - 1] : 0;
+        report_.has_upper = rank_ + 1 < workers_;
+        report_.upper = report_.has_upper ? splitters_[rank_] : 0;
+
+        // 本地排序就是分区输出，分割点对所有进程都相同，第 j 个分区正好是要发给进程 j 的数据
+        SortOptions local = options_;
+        local.partitions = workers_;
+        local.splitters = splitters_;
+        {
+            ExternalSorter sorter(local_path_, local, &memory_);
+            sorter.Sort(input_files);
+            for (const auto& part : sorter.GetPartitions()) {
+                report_.local_records += part.records;
+            }
+        }
+        auto sorted = std::chrono::steady_clock::now();
+        report_.sort_seconds = std::chrono::duration<double>(sorted - start).count();
+
+        Shuffle();
+        report_.shuffle_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - sorted).count();
+        return report_;
+    }
+
+private:
+    size_t rank_;
+    size_t workers_;
+    std::vector<std::string> addresses_;
+    int listen_fd_;
+    std::string output_path_; // 本进程输出分区的文件，先写到 .tmp，由父进程在所有进程成功后改名
+    std::string local_path_; // 本地分区输出的文件名前缀
+    SortOptions options_;
+    MemoryBudget memory_; // 本地排序和洗牌先后使用的同一份预算
+    std::vector<int> outgoing_; // 发往每个进程的连接
+    std::vector<int> incoming_; // 来自每个进程的连接
+    std::vector<int64_t> splitters_;
+    DistReport report_;
+
+    uint32_t RecordSize() const {
+        return options_.mode == AggregateMode::kCount ? 2 * sizeof(int64_t) : sizeof(int64_t);
+    }
+
+    bool InRanges(int64_t key) const {
+        if (options_.ranges.empty()) {
+            return true;
+        }
+        for (const auto& range : options_.ranges) {
+            if (key >= range.first && key <= range.second) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 连接所有进程（包括自己）并发出握手和样本，再接受所有进程的连接、读入它们的样本。
+    // 监听队列能容纳所有连接，握手和样本也放得进套接字缓存，所以先全部发出再接受不会互相等待
+    std::vector<int64_t> ExchangeSamples(const std::vector<std::string>& input_files) {
+        std::vector<int64_t> samples;
+        uint64_t total = SampleKeys(input_files, samples);
+        DistHello hello{static_cast<uint32_t>(rank_), static_cast<uint32_t>(samples.size()), total};
+        for (size_t j = 0; j < workers_; ++j) {
+            outgoing_[j] = ConnectSocket(addresses_[j], DIST_CONNECT_WAIT_MS);
+            SendAll(outgoing_[j], &hello, sizeof(hello));
+            SendAll(outgoing_[j], samples.data(), samples.size() * sizeof(int64_t));
+        }
+
+        std::vector<std::pair<int64_t, double>> weighted; // (样本, 代表的键数)
+        for (size_t k = 0; k < workers_; ++k) {
+            int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                throw std::runtime_error(std::string("accept 失败: ") + std::strerror(errno));
+            }
+            DistHello peer;
+            if (ReceiveAll(fd, &peer, sizeof(peer)) != sizeof(peer) || peer.rank >= workers_ ||
+                incoming_[peer.rank] >= 0 || peer.sample_count > DIST_SAMPLES) {
+                ::close(fd);
+                throw std::runtime_error("收到无效的握手消息");
+            }
+            incoming_[peer.rank] = fd;
+            std::vector<int64_t> keys(peer.sample_count);
+            size_t bytes = keys.size() * sizeof(int64_t);
+            if (ReceiveAll(fd, keys.data(), bytes) != bytes) {
+                throw std::runtime_error("接收样本失败");
+            }
+            double weight = keys.empty() ? 0.0 : static_cast<double>(peer.total_keys) / keys.size();
+            for (int64_t key : keys) {
+                weighted.push_back({key, weight});
+            }
+        }
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        return WeightedSplitters(weighted);
+    }
+
+    // 从分到的输入文件中均匀地随机抽取键（每个样本一次 pread），返回通过范围过滤的键数的估计
+    uint64_t SampleKeys(const std::vector<std::string>& files, std::vector<int64_t>& samples) {
+        std::vector<uint64_t> offsets; // 每个文件第一个键在全部键中的序号
+        uint64_t total = 0;
+        for (const auto& file : files) {
+            offsets.push_back(total);
+            std::error_code ec;
+            uintmax_t size = std::filesystem::file_size(file, ec);
+            total += ec ? 0 : size / sizeof(int64_t);
+        }
+        report_.input_keys = total;
+        size_t sample_count = std::min<uint64_t>(DIST_SAMPLES, total);
+        if (sample_count == 0) {
+            return 0;
+        }
+
+        std::mt19937_64 random(total + rank_);
+        std::vector<int> fds;
+        std::vector<SimulatedDisk*> disks;
+        for (const auto& file : files) {
+            fds.push_back(::open(file.c_str(), O_RDONLY));
+            disks.push_back(DiskSimulator::Instance().Find(file));
+        }
+        size_t drawn = 0;
+        for (size_t i = 0; i < sample_count; ++i) {
+            uint64_t index = random() % total;
+            size_t f = std::upper_bound(offsets.begin(), offsets.end(), index) - offsets.begin() - 1;
+            int64_t key;
+            uint64_t offset = (index - offsets[f]) * sizeof(key);
+            if (fds[f] >= 0 && ::pread(fds[f], &key, sizeof(key), offset) == static_cast<ssize_t>(sizeof(key))) {
+                ++drawn;
+                if (InRanges(key)) {
+                    samples.push_back(key);
+                }
+                if (disks[f]) {
+                    disks[f]->Transfer(&fds[f], offset, sizeof(key), false);
+                }
+            }
+        }
+        for (int fd : fds) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        return drawn == 0 ? 0 : total * samples.size() / drawn;
+    }
+
+    // 按样本代表的键数累计，第 j 个分割点是累计数第一次达到总数 j / workers 处的样本。
+    // 每个进程收到的样本和权重都相同，算出的分割点也相同；热点键可能使相邻的分割点相等，中间的分区为空
+    std::vector<int64_t> WeightedSplitters(std::vector<std::pair<int64_t, double>>& weighted) const {
+        std::sort(weighted.begin(), weighted.end());
+        double total = 0;
+        for (const auto& sample : weighted) {
+            total += sample.second;
+        }
+        std::vector<int64_t> splitters;
+        double cumulative = 0;
+        for (const auto& sample : weighted) {
+            while (splitters.size() + 1 < workers_ && cumulative >= total * (splitters.size() + 1) / workers_) {
+                splitters.push_back(sample.first);
+            }
+            cumulative += sample.second;
+        }
+        while (splitters.size() + 1 < workers_) {
+            splitters.push_back(weighted.empty() ? 0 : weighted.back().first);
+        }
+        return splitters;
+    }
+
+    // 每个目标进程一个发送线程，主线程同时归并收到的数据。发送和接收都按批进行，
+    // 每个发送线程在发出一批的同时读入下一批，磁盘读取、网络传输和归并互相重叠
+    void Shuffle() {
+        // 每个发送线程两批（正在发送的和预读的），每个接收流一批，再加一个写出缓存
+        size_t buffers = 3 * workers_ + 1;
+        size_t batch = std::min(memory_.Available() / buffers, DIST_BATCH_BYTES) / RecordSize() * RecordSize();
+        batch = std::max<size_t>(batch, RecordSize());
+        MemoryReservation shuffle_memory(memory_, batch * buffers, "洗牌缓存");
+
+        std::vector<std::future<uint64_t>> senders;
+        for (size_t j = 0; j < workers_; ++j) {
+            senders.push_back(std::async(std::launch::async, [this, j, batch]() { return SendPartition(j, batch); }));
+        }
+        try {
+            ReceivePartition(batch);
+        } catch (...) {
+            // 让阻塞在发送上的线程出错返回，否则等待它们结束时会一直卡住
+            for (int fd : outgoing_) {
+                ::shutdown(fd, SHUT_RDWR);
+            }
+            throw;
+        }
+        for (size_t j = 0; j < workers_; ++j) {
+            uint64_t sent = senders[j].get();
+            report_.bytes_sent += sent;
+            report_.bytes_remote += j == rank_ ? 0 : sent;
+        }
+    }
+
+    // 把本地的第 j 个分区发给进程 j，发完后关闭连接的写方向，对方读到结束标志
+    uint64_t SendPartition(size_t j, size_t batch) {
+        std::string path = local_path_ + ".part" + std::to_string(j);
+        DiskInputFile input;
+        OpenUnbuffered(input, path);
+        if (!input.is_open()) {
+            throw std::runtime_error("无法打开本地分区: " + path);
+        }
+        auto fill = [&input](std::vector<char>& buffer) {
+            input.read(buffer.data(), buffer.size());
+            return static_cast<size_t>(input.gcount());
+        };
+        std::vector<char> current(batch);
+        std::vector<char> next(batch);
+        uint64_t sent = 0;
+        for (size_t size = fill(current); size > 0;) {
+            auto reading = std::async(std::launch::async, fill, std::ref(next));
+            SendAll(outgoing_[j], current.data(), size);
+            sent += size;
+            size = reading.get();
+            std::swap(current, next);
+        }
+        ::shutdown(outgoing_[j], SHUT_WR);
+        return sent;
+    }
+
+    // 多路归并所有进程发来的有序数据，相同的键都发给了同一个进程，聚合与 MergePartition 相同
+    void ReceivePartition(size_t batch) {
+        struct Record {
+            int64_t key;
+            uint64_t count;
+        };
+        size_t record_size = RecordSize();
+        std::vector<std::unique_ptr<SocketRecordReader>> readers;
+        std::vector<Record> heads(workers_, Record{0, 1});
+        using HeapItem = std::pair<int64_t, size_t>;
+        std::priority_queue<HeapItem, std::vector<HeapItem>, std::greater<HeapItem>> heap;
+        for (size_t k = 0; k < workers_; ++k) {
+            readers.push_back(std::make_unique<SocketRecordReader>(incoming_[k], batch));
+            if (readers[k]->Read(&heads[k], record_size)) {
+                heap.push({heads[k].key, k});
+            }
+        }
+
+        DiskOutputFile output;
+        OpenUnbuffered(output, output_path_ + ".tmp");
+        if (!output.is_open()) {
+            throw std::runtime_error("无法创建分区文件: " + output_path_);
+        }
+        Buffer buffer(batch);
+        auto emit = [&](int64_t key, uint64_t count) {
+            Record record{key, count};
+            if (!buffer.Write(&record, record_size)) {
+                output.write(buffer.GetBuffer(), buffer.GetWritePos());
+                buffer.Reset();
+                buffer.Write(&record, record_size);
+            }
+            report_.min_key = report_.records == 0 ? key : report_.min_key;
+            report_.max_key = key;
+            ++report_.records;
+        };
+        bool has_pending = false;
+        Record pending{0, 0};
+        while (!heap.empty()) {
+            size_t index = heap.top().second;
+            heap.pop();
+            Record record = heads[index];
+            if (options_.mode == AggregateMode::kNone) {
+                emit(record.key, 1);
+            } else if (has_pending && record.key == pending.key) {
+                pending.count += record.count;
+            } else {
+                if (has_pending) {
+                    emit(pending.key, pending.count);
+                }
+                pending = record;
+                has_pending = true;
+            }
+            if (readers[index]->Read(&heads[index], record_size)) {
+                heap.push({heads[index].key, index});
+            }
+        }
+        if (has_pending) {
+            emit(pending.key, pending.count);
+        }
+        output.write(buffer.GetBuffer(), buffer.GetWritePos());
+        output.close();
+        if (!output) {
+            throw std::runtime_error("无法写入分区文件: " + output_path_);
+        }
+        for (const auto& reader : readers) {
+            report_.bytes_received += reader->Bytes();
+        }
+    }
+};
+
+// 本机工作进程的入口，返回进程的退出码。share 是分给这个进程的输入文件，报告写入管道
+int RunDistributedWorker(size_t rank, const std::vector<std::string>& addresses, int listen_fd, int report_fd,
+                         const std::string& output_file, const std::string& local_prefix, const SortOptions& options,
+                         const std::vector<std::string>& share) {
+    try {
+        DistributedWorker worker(rank, addresses, listen_fd, output_file + ".part" + std::to_string(rank),
+                                 local_prefix + "_r" + std::to_string(rank) + ".bin", options);
+        DistReport report = worker.Run(share);
+        if (::write(report_fd, &report, sizeof(report)) != static_cast<ssize_t>(sizeof(report))) {
+            throw std::runtime_error("无法写入报告");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "工作进程 " << rank << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 删除 temp_sort 中以 local_prefix 开头的文件（本地分区、清单和套接字），以及 pids 中的进程留下的归并段
+// （文件名中带有进程号）。失败的工作进程来不及自己清理
+void RemoveDistTempFiles(const std::string& local_prefix, const std::vector<pid_t>& pids) {
+    for (const auto& entry : std::filesystem::directory_iterator("temp_sort")) {
+        std::string name = entry.path().filename().string();
+        bool owned = name.rfind(local_prefix + "_", 0) == 0;
+        for (size_t k = 0; !owned && entry.is_regular_file() && k < pids.size(); ++k) {
+            owned = name.find("_" + std::to_string(pids[k]) + "_") != std::string::npos;
+        }
+        if (owned) {
+            std::filesystem::remove(entry.path());
+        }
+    }
+}
+
+// --dist-worker 模式：多台机器上各运行一个工作进程，peers 按序号列出所有进程监听的 "<IPv4 地址>:<端口>"，
+// 本进程是其中的第 rank 个，在 bind 上监听。每个进程排序本机 names.txt 中的全部输入，
+// 输出全局有序结果中自己负责的分区 <输出>.part<rank> 和只有这一行的清单 <输出>.part<rank>.parts，
+// 按序号拼接各个进程的清单就是完整的分区清单
+int RunDistributedNode(size_t rank, const std::vector<std::string>& peers, const std::string& bind,
+                       const std::string& output_file, const SortOptions& options,
+                       const std::vector<std::string>& input_files) {
+    std::filesystem::create_directories("temp_sort");
+    std::string local_prefix = "dist_" + std::to_string(getpid());
+    std::vector<std::string> addresses;
+    for (const auto& peer : peers) {
+        addresses.push_back("tcp:" + peer);
+    }
+    PartitionInfo part;
+    part.path = output_file + ".part" + std::to_string(rank);
+    DistReport report;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        std::string address;
+        int listen_fd = ListenSocket("tcp", bind, static_cast<int>(peers.size()), address);
+        DistributedWorker worker(rank, addresses, listen_fd, part.path, "temp_sort/" + local_prefix + "_r" +
+                                 std::to_string(rank) + ".bin", options);
+        report = worker.Run(input_files);
+        std::filesystem::rename(part.path + ".tmp", part.path);
+    } catch (const std::exception& e) {
+        std::cerr << "排序失败: " << e.what() << std::endl;
+        std::filesystem::remove(part.path + ".tmp");
+        RemoveDistTempFiles(local_prefix, {getpid()});
+        return -1;
+    }
+    RemoveDistTempFiles(local_prefix, {});
+    part.has_lower = report.has_lower;
+    part.lower = report.lower;
+    part.has_upper = report.has_upper;
+    part.upper = report.upper;
+    part.records = report.records;
+    part.min_key = report.min_key;
+    part.max_key = report.max_key;
+    try {
+        WritePartitionManifest(part.path + PARTS_SUFFIX, {part});
+    } catch (const std::exception& e) {
+        std::cerr << "排序失败: " << e.what() << std::endl;
+        return -1;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "排序完成，第 " << rank << " 个分区保存为 " << part.path << "，清单 " << part.path << PARTS_SUFFIX
+              << std::endl;
+    std::cout << "工作进程 " << rank << "/" << peers.size() << ": 输入 " << report.input_keys << " 个键，本地排序后 "
+              << report.local_records << " 条记录，用时 " << report.sort_seconds << " 秒；发送 " << report.bytes_sent
+              << " 字节（发往其他进程 " << report.bytes_remote << " 字节），接收 " << report.bytes_received
+              << " 字节，洗牌用时 " << report.shuffle_seconds << " 秒；输出 " << report.records << " 条记录" << std::endl;
+    std::cout << "排序耗时 " << elapsed << " 秒" << std::endl;
+    return 0;
+}
+
+// --dist-local 模式：在本机启动 workers 个工作进程做分布式排序，每个进程输出一个按键范围划分的分区。
+// 与 --dist-worker 使用相同的工作进程，只是由这里分配输入文件、创建监听套接字并汇总结果
+int SortDistributed(const std::string& output_file, const SortOptions& options, size_t workers,
+                    const std::string& transport, const std::vector<std::string>& input_files) {
+    // 工作进程同时运行，--memory（或自动确定的预算）是它们合计的上限，平均分给每个进程。
+    // 自动确定的预算不够分时每个进程取最小预算，显式给出的预算不够分时报错
+    SortOptions worker_options = options;
+    worker_options.memory_limit = MemoryBudget(options.memory_limit, DEFAULT_MEMORY_BUDGET).Limit() / workers;
+    if (worker_options.memory_limit < MIN_MEMORY_BUDGET) {
+        if (options.memory_limit != 0) {
+            std::cerr << "排序失败: 内存预算不足以分给 " << workers << " 个工作进程，每个进程至少需要 "
+                      << MIN_MEMORY_BUDGET << " 字节" << std::endl;
+            return -1;
+        }
+        worker_options.memory_limit = MIN_MEMORY_BUDGET;
+    }
+
+    std::filesystem::create_directories("temp_sort");
+    std::string local_prefix = "dist_" + std::to_string(getpid());
+    std::vector<pid_t> children;
+    // 失败时被结束的工作进程来不及清理，由这里删除它们的归并段和没有改名的分区文件
+    auto cleanup = [&](bool failed) {
+        RemoveDistTempFiles(local_prefix, failed ? children : std::vector<pid_t>());
+        for (size_t r = 0; failed && r < workers; ++r) {
+            std::filesystem::remove(output_file + ".part" + std::to_string(r) + ".tmp");
+        }
+    };
+
+    std::vector<int> listeners;
+    std::vector<std::string> addresses;
+    try {
+        for (size_t r = 0; r < workers; ++r) {
+            std::string address;
+            std::string where = transport == "tcp" ? "127.0.0.1:0"
+                                : "temp_sort/" + local_prefix + "_" + std::to_string(r) + ".sock";
+            listeners.push_back(ListenSocket(transport, where, static_cast<int>(workers), address));
+            addresses.push_back(address);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "排序失败: " << e.what() << std::endl;
+        for (int fd : listeners) {
+            ::close(fd);
+        }
+        cleanup(true);
+        return -1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::cout.flush();
+    std::vector<int> report_fds;
+    for (size_t r = 0; r < workers; ++r) {
+        int fds[2];
+        pid_t pid = ::pipe2(fds, O_CLOEXEC) == 0 ? ::fork() : -1;
+        if (pid == 0) {
+            ::close(fds[0]);
+            for (size_t k = 0; k < workers; ++k) {
+                if (k != r) {
+                    ::close(listeners[k]);
+                }
+            }
+            // 按序号轮流分配输入文件
+            std::vector<std::string> share;
+            for (size_t i = r; i < input_files.size(); i += workers) {
+                share.push_back(input_files[i]);
+            }
+            int code = RunDistributedWorker(r, addresses, listeners[r], fds[1], output_file,
+                                            "temp_sort/" + local_prefix, worker_options, share);
+            std::cout.flush();
+            ::_exit(code);
+        }
+        if (pid < 0) {
+            std::cerr << "排序失败: 无法启动工作进程: " << std::strerror(errno) << std::endl;
+            for (pid_t child : children) {
+                ::kill(child, SIGTERM);
+                ::waitpid(child, nullptr, 0);
+            }
+            cleanup(true);
+            return -1;
+        }
+        ::close(fds[1]);
+        children.push_back(pid);
+        report_fds.push_back(fds[0]);
+    }
+    for (int fd : listeners) {
+        ::close(fd);
+    }
+
+    // 一个进程失败时其他进程可能在等它的数据，结束其余的进程
+    bool failed = false;
+    std::vector<bool> running(workers, true);
+    for (size_t remaining = workers; remaining > 0;) {
+        int status;
+        pid_t pid = ::waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        size_t rank = std::find(children.begin(), children.end(), pid) - children.begin();
+        if (rank == workers) {
+            continue;
+        }
+        running[rank] = false;
+        --remaining;
+        if ((!WIFEXITED(status) || WEXITSTATUS(status) != 0) && !failed) {
+            std::cerr << "排序失败: 工作进程 " << rank << " 失败" << std::endl;
+            failed = true;
+            for (size_t k = 0; k < workers; ++k) {
+                if (running[k]) {
+                    ::kill(children[k], SIGTERM);
+                }
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<DistReport> reports(workers);
+    for (size_t r = 0; r < workers; ++r) {
+        if (!failed && ::read(report_fds[r], &reports[r], sizeof(DistReport)) != static_cast<ssize_t>(sizeof(DistReport))) {
+            std::cerr << "排序失败: 没有收到工作进程 " << r << " 的报告" << std::endl;
+            failed = true;
+        }
+        ::close(report_fds[r]);
+    }
+    std::vector<PartitionInfo> partitions(workers);
+    for (size_t r = 0; r < workers; ++r) {
+        PartitionInfo& part = partitions[r];
+        part.path = output_file + ".part" + std::to_string(r);
+        part.has_lower = reports[r].has_lower;
+        part.lower = reports[r].lower;
+        part.has_upper = reports[r].has_upper;
+        part.upper = reports[r].upper;
+        part.records = reports[r].records;
+        part.min_key = reports[r].min_key;
+        part.max_key = reports[r].max_key;
+    }
+    try {
+        if (!failed) {
+            // 所有进程都成功之后再一起改名，与单进程的分区输出相同
+            for (const auto& part : partitions) {
+                std::filesystem::rename(part.path + ".tmp", part.path);
+            }
+            for (size_t p = workers; std::filesystem::exists(output_file + ".part" + std::to_string(p)); ++p) {
+                std::filesystem::remove(output_file + ".part" + std::to_string(p));
+            }
+            WritePartitionManifest(output_file + PARTS_SUFFIX, partitions);
+            // 各进程的输入哈希没有汇总，.sum 中只记录格式
+            SumInfo info;
+            info.mode = options.mode == AggregateMode::kCount      ? "count"
+                        : options.mode == AggregateMode::kDistinct ? "distinct" : "none";
+            info.record_size = options.mode == AggregateMode::kCount ? 2 * sizeof(int64_t) : sizeof(int64_t);
+            info.partitions = static_cast<uint32_t>(workers);
+            if (!WriteSumFile(output_file + SUM_SUFFIX, info)) {
+                std::cerr << "无法写入哈希文件: " << output_file << SUM_SUFFIX << std::endl;
+            }
+            std::filesystem::remove(output_file); // 上次不分区时留下的单个输出文件和它的索引
+            std::filesystem::remove(output_file + INDEX_SUFFIX);
+        }
+        cleanup(failed);
+    } catch (const std::exception& e) {
+        std::cerr << "排序失败: " << e.what() << std::endl;
+        return -1;
+    }
+    if (failed) {
+        return -1;
+    }
+
+    uint64_t sent = 0;
+    uint64_t remote = 0;
+    uint64_t most = 0;
+    uint64_t output_records = 0;
+    double slowest = 0;
+    std::cout << "排序完成，结果按键范围保存为 " << workers << " 个文件 " << output_file << ".part*，清单 " << output_file
+              << PARTS_SUFFIX << std::endl;
+    std::cout << "分布式排序: " << workers << " 个工作进程，通过 " << (transport == "tcp" ? "TCP" : "Unix 域套接字")
+              << " 洗牌" << std::endl;
+    for (size_t r = 0; r < workers; ++r) {
+        const DistReport& report = reports[r];
+        std::cout << "工作进程 " << r << ": 输入 " << report.input_keys << " 个键，本地排序后 " << report.local_records
+                  << " 条记录，用时 " << report.sort_seconds << " 秒；发送 " << report.bytes_sent << " 字节（发往其他进程 "
+                  << report.bytes_remote << " 字节），接收 " << report.bytes_received << " 字节，洗牌用时 "
+                  << report.shuffle_seconds << " 秒；输出 " << report.records << " 条记录" << std::endl;
+        sent += report.bytes_sent;
+        remote += report.bytes_remote;
+        most = std::max(most, report.records);
+        output_records += report.records;
+        slowest = std::max(slowest, report.shuffle_seconds);
+    }
+    // 带宽按最慢的进程完成洗牌的时间计算；偏斜是输出最多的分区与平均值之比，1 表示完全均衡
+    double megabytes = 1024.0 * 1024.0;
+    double bandwidth = slowest > 0 ? sent / megabytes / slowest : 0.0;
+    double remote_bandwidth = slowest > 0 ? remote / megabytes / slowest : 0.0;
+    double average = static_cast<double>(output_records) / workers;
+    std::cout << "洗牌: 共发送 " << sent << " 字节，其中跨进程 " << remote << " 字节，用时 " << slowest << " 秒，带宽 "
+              << bandwidth << " MB/s（跨进程 " << remote_bandwidth << " MB/s）" << std::endl;
+    std::cout << "负载偏斜: 每个分区平均 " << average << " 条记录，最多 " << most << " 条，最多/平均 "
+              << (average > 0 ? most / average : 0.0) << std::endl;
+    std::cout << "排序耗时 " << elapsed << " 秒" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    SortOptions options;
+    size_t dist_workers = 0; // 大于 0 时在本机启动这么多个工作进程做分布式排序
+    std::string dist_transport = "unix"; // 工作进程之间洗牌使用的套接字
+    int64_t dist_rank = -1; // 不小于 0 时本进程是多台机器上的分布式排序中的一个工作进程
+    std::vector<std::string> dist_peers; // 所有工作进程监听的地址，按序号排列
+    std::string dist_bind; // 本进程监听的地址，默认为 dist_peers 中自己的地址
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--distinct" && options.mode == AggregateMode::kNone) {
+            options.mode = AggregateMode::kDistinct;
+        } else if (arg == "--count" && options.mode == AggregateMode::kNone) {
+            options.mode = AggregateMode::kCount;
+        } else if ((arg == "--smallest" || arg == "--largest") && i + 1 < argc && options.limit == 0) {
+            int64_t limit;
+            if (!ParseArgument(argv[++i], 1, INT64_MAX, limit)) {
+                std::cerr << "键数必须是正整数: " << argv[i] << std::endl;
+                return -1;
+            }
+            options.limit = static_cast<size_t>(limit);
+            options.descending = arg == "--largest";
+        } else if (arg == "--range" && i + 1 < argc) {
+            // 格式为 lo:hi，从第二个字符开始查找分隔符以允许负数下界
+            std::string range = argv[++i];
+            size_t colon = range.find(':', 1);
+            if (colon == std::string::npos) {
+                std::cerr << "无效的范围: " << range << std::endl;
+                return -1;
+            }
+            int64_t lo;
+            int64_t hi;
+            if (!ParseArgument(range.substr(0, colon), INT64_MIN, INT64_MAX, lo) ||
+                !ParseArgument(range.substr(colon + 1), INT64_MIN, INT64_MAX, hi) || lo > hi) {
+                std::cerr << "无效的范围: " << range << std::endl;
+                return -1;
+            }
+            options.ranges.push_back({lo, hi});
+        } else if (arg == "--incremental") {
+            options.incremental = true;
+        } else if (arg == "--job" && i + 1 < argc) {
+            options.job_id = argv[++i];
+        } else if (arg == "--no-index") {
+            options.build_index = false;
+        } else if (arg == "--index-every" && i + 1 < argc) {
+            int64_t every;
+            if (!ParseArgument(argv[++i], 1, UINT32_MAX, every)) {
+                std::cerr << "索引每块的记录数必须在 1 到 " << UINT32_MAX << " 之间: " << argv[i] << std::endl;
+                return -1;
+            }
+            options.index_every = static_cast<size_t>(every);
+        } else if (arg == "--bloom-bits" && i + 1 < argc) {
+            int64_t bits;
+            if (!ParseArgument(argv[++i], 0, MAX_BLOOM_BITS, bits)) {
+                std::cerr << "Bloom 过滤器每个键的比特数必须在 0 到 " << MAX_BLOOM_BITS << " 之间: " << argv[i] << std::endl;
+                return -1;
+            }
+            options.bloom_bits = static_cast<uint32_t>(bits);
+        } else if (arg == "--memory" && i + 1 < argc) {
+            // 字节数，可以带 K、M、G 后缀
+            std::string value = argv[++i];
+            size_t unit = 1;
+            char suffix = value.empty() ? '\0' : std::toupper(static_cast<unsigned char>(value.back()));
+            if (suffix == 'K' || suffix == 'M' || suffix == 'G') {
+                unit = suffix == 'K' ? 1024 : suffix == 'M' ? 1024 * 1024 : 1024 * 1024 * 1024;
+                value.pop_back();
+            }
+            int64_t count;
+            if (!ParseArgument(value, 0, INT64_MAX, count) || static_cast<uint64_t>(count) > SIZE_MAX / unit) {
+                std::cerr << "无效的内存预算: " << argv[i] << std::endl;
+                return -1;
+            }
+            options.memory_limit = static_cast<size_t>(count) * unit;
+            if (options.memory_limit < MIN_MEMORY_BUDGET) {
+                std::cerr << "内存预算至少为 " << MIN_MEMORY_BUDGET << " 字节" << std::endl;
+                return -1;
+            }
+        } else if (arg == "--engine" && i + 1 < argc) {
+            std::string engine = argv[++i];
+            if (engine == "auto") {
+                options.engine = SortEngine::kAuto;
+            } else if (engine == "merge") {
+                options.engine = SortEngine::kMerge;
+            } else if (engine == "bucket") {
+                options.engine = SortEngine::kBucket;
+            } else {
+                std::cerr << "未知的排序引擎: " << engine << std::endl;
+                return -1;
+            }
+        } else if (arg == "--disk-profile" && i + 1 < argc) {
+            // 格式为 目录=配置，该目录下的文件按配置的模拟磁盘读写，可以重复指定多个目录
+            std::string value = argv[++i];
+            size_t eq = value.find('=');
+            DiskProfile profile;
+            if (eq == std::string::npos || eq == 0 || !ParseDiskProfile(value.substr(eq + 1), profile)) {
+                std::cerr << "无效的磁盘配置: " << value << std::endl;
+                return -1;
+            }
+            DiskSimulator::Instance().Attach(value.substr(0, eq), profile);
+        } else if (arg == "--partitions" && i + 1 < argc) {
+            int64_t partitions;
+            if (!ParseArgument(argv[++i], 1, UINT32_MAX, partitions)) {
+                std::cerr << "分区数必须是正整数: " << argv[i] << std::endl;
+                return -1;
+            }
+            options.partitions = static_cast<size_t>(partitions);
+        } else if (arg == "--splitters" && i + 1 < argc) {
+            // 逗号分隔的严格递增的键
+            std::string list = argv[++i];
+            size_t start = 0;
+            while (start <= list.size()) {
+                size_t comma = list.find(',', start);
+                if (comma == std::string::npos) {
+                    comma = list.size();
+                }
+                int64_t splitter;
+                if (!ParseArgument(list.substr(start, comma - start), INT64_MIN, INT64_MAX, splitter)) {
+                    std::cerr << "无效的分割点: " << list << std::endl;
+                    return -1;
+                }
+                options.splitters.push_back(splitter);
+                start = comma + 1;
+            }
+            if (!std::is_sorted(options.splitters.begin(), options.splitters.end(), std::less_equal<int64_t>())) {
+                std::cerr << "分割点必须严格递增: " << list << std::endl;
+                return -1;
+            }
+        } else if (arg == "--dist-local" && i + 1 < argc) {
+            int64_t workers;
+            if (!ParseArgument(argv[++i], 1, MAX_DIST_WORKERS, workers)) {
+                std::cerr << "工作进程数必须在 1 到 " << MAX_DIST_WORKERS << " 之间: " << argv[i] << std::endl;
+                return -1;
+            }
+            dist_workers = static_cast<size_t>(workers);
+        } else if (arg == "--dist-worker" && i + 1 < argc) {
+            if (!ParseArgument(argv[++i], 0, MAX_DIST_WORKERS - 1, dist_rank)) {
+                std::cerr << "工作进程的序号必须在 0 到 " << MAX_DIST_WORKERS - 1 << " 之间: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--peers" && i + 1 < argc) {
+            // 逗号分隔的 <IPv4 地址>:<端口>
+            std::string list = argv[++i];
+            size_t start = 0;
+            while (start <= list.size()) {
+                size_t comma = list.find(',', start);
+                if (comma == std::string::npos) {
+                    comma = list.size();
+                }
+                std::string peer = list.substr(start, comma - start);
+                sockaddr_in addr;
+                if (!ParseTcpAddress(peer, addr) || addr.sin_port == 0) {
+                    std::cerr << "无效的工作进程地址: " << peer << std::endl;
+                    return -1;
+                }
+                dist_peers.push_back(peer);
+                start = comma + 1;
+            }
+            if (dist_peers.size() > MAX_DIST_WORKERS) {
+                std::cerr << "工作进程最多 " << MAX_DIST_WORKERS << " 个" << std::endl;
+                return -1;
+            }
+        } else if (arg == "--dist-bind" && i + 1 < argc) {
+            dist_bind = argv[++i];
+            sockaddr_in addr;
+            if (!ParseTcpAddress(dist_bind, addr)) {
+                std::cerr << "无效的监听地址: " << dist_bind << std::endl;
+                return -1;
+            }
+        } else if (arg == "--dist-transport" && i + 1 < argc) {
+            dist_transport = argv[++i];
+            if (dist_transport != "unix" && dist_transport != "tcp") {
+                std::cerr << "未知的传输方式: " << dist_transport << std::endl;
+                return -1;
+            }
+        } else if (arg == "--strings") {
+            options.strings = true;
+        } else if (arg == "--numa") {
+            options.numa = true;
+        } else if (arg == "--text") {
+            options.text_input = true;
+        } else if (arg == "--csv-column" && i + 1 < argc) {
+            options.text_input = true;
+            int64_t column;
+            if (!ParseArgument(argv[++i], 1, UINT32_MAX, column)) {
+                std::cerr << "列号必须是从 1 开始的整数: " << argv[i] << std::endl;
+                return -1;
+            }
+            options.text_column = static_cast<size_t>(column);
+        } else if (arg == "--delimiter" && i + 1 < argc) {
+            // 支持用 \t 表示制表符
+            std::string delimiter = argv[++i];
+            if (delimiter == "\\t") {
+                delimiter = "\t";
+            }
+            if (delimiter.size() != 1 || delimiter[0] == '\n') {
+                std::cerr << "分隔符必须是一个字符: " << delimiter << std::endl;
+                return -1;
+            }
+            options.delimiter = delimiter[0];
+        } else {
+            std::cerr << "无效的参数: " << arg << std::endl;
+            return -1;
+        }
+    }
+    if (options.limit > 0 && options.mode != AggregateMode::kNone) {
+        std::cerr << "--smallest/--largest 不能与 --distinct/--count 同时使用" << std::endl;
+        return -1;
+    }
+    if (options.limit > 0 && options.incremental) {
+        std::cerr << "--smallest/--largest 不能与 --incremental 同时使用" << std::endl;
+        return -1;
+    }
+    // 已有输出中范围以外的键无法在归并时去掉
+    if (!options.ranges.empty() && options.incremental) {
+        std::cerr << "--range 不能与 --incremental 同时使用" << std::endl;
+        return -1;
+    }
+    if (options.engine == SortEngine::kBucket && (options.text_input || options.incremental ||
+                                                  !options.job_id.empty() || options.numa || options.limit > 0)) {
+        std::cerr << "--engine bucket 不能与 --text/--csv-column、--incremental、--job、--numa、--smallest/--largest 同时使用"
+                  << std::endl;
+        return -1;
+    }
+    if (!options.splitters.empty()) {
+        if (options.partitions != 0 && options.partitions != options.splitters.size() + 1) {
+            std::cerr << "--partitions 必须比分割点的个数多 1" << std::endl;
+            return -1;
+        }
+        options.partitions = options.splitters.size() + 1;
+    }
+    if (options.partitions > 0 && (options.limit > 0 || options.incremental || !options.job_id.empty() ||
+                                   options.strings || options.engine == SortEngine::kBucket)) {
+        std::cerr << "--partitions/--splitters 不能与 --smallest/--largest、--incremental、--job、--strings、--engine bucket 同时使用"
+                  << std::endl;
+        return -1;
+    }
+    if (options.strings && (options.mode == AggregateMode::kCount || options.limit > 0 || !options.ranges.empty() ||
+                            options.incremental || !options.job_id.empty() || options.text_input || options.numa ||
+                            options.engine == SortEngine::kBucket)) {
+        std::cerr << "--strings 只能与 --distinct、--memory、--disk-profile 同时使用" << std::endl;
+        return -1;
+    }
+    if ((dist_rank >= 0) != !dist_peers.empty() ||
+        (dist_rank >= 0 && static_cast<size_t>(dist_rank) >= dist_peers.size())) {
+        std::cerr << "--dist-worker 需要 --peers 列出包括自己在内的所有工作进程的地址" << std::endl;
+        return -1;
+    }
+    if (dist_rank >= 0 && dist_workers > 0) {
+        std::cerr << "--dist-worker 不能与 --dist-local 同时使用" << std::endl;
+        return -1;
+    }
+    if ((dist_workers > 0 || dist_rank >= 0) &&
+        (options.limit > 0 || options.incremental || !options.job_id.empty() || options.strings ||
+         options.text_input || options.partitions > 0 || options.engine == SortEngine::kBucket)) {
+        std::cerr << "--dist-local/--dist-worker 不能与 --smallest/--largest、--incremental、--job、--strings、"
+                     "--text/--csv-column、--partitions/--splitters、--engine bucket 同时使用"
+                  << std::endl;
+        return -1;
+    }
+    NormalizeRanges(options.ranges);
+
+    std::string input_dir = "test_files"; // 更新为包含names.txt的文件夹路径
+    std::string output_file = "sorted_data.bin";
+    std::vector<std::string> input_files;
+
+    // 从test_files/names.txt文件中读取需要排序的文件名
+    std::ifstream name_file(input_dir + "/names.txt"); // 更新文件路径
+    if (name_file.is_open()) {
+        std::string file_name;
+        while (std::getline(name_file, file_name)) {
+            input_files.push_back(input_dir + "/" + file_name);
+        }
+        name_file.close();
+    } else {
+        std::cerr << "无法打开names.txt" << std::endl;
+        return -1;
+    }
+
+    if (options.strings) {
+        return SortStrings(output_file, options, input_files);
+    }
+    if (dist_workers > 0) {
+        return SortDistributed(output_file, options, dist_workers, dist_transport, input_files);
+    }
+    if (dist_rank >= 0) {
+        return RunDistributedNode(static_cast<size_t>(dist_rank), dist_peers,
+                                  dist_bind.empty() ? dist_peers[dist_rank] : dist_bind, output_file, options, input_files);
+    }
+
+    ExternalSorter sorter(output_file, options);
+    auto start = std::chrono::steady_clock::now();
+    try {
+        sorter.Sort(input_files);
+    } catch (const std::exception& e) {
+        std::cerr << "排序失败: " << e.what() << std::endl;
+        return -1;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const SortStats& stats = sorter.GetStats();
+    const MemoryBudget& memory = sorter.GetMemoryBudget();
+    if (options.partitions > 0) {
+        const auto& partitions = sorter.GetPartitions();
+        uint64_t fewest = UINT64_MAX;
+        uint64_t most = 0;
+        for (const auto& part : partitions) {
+            fewest = std::min(fewest, part.records);
+            most = std::max(most, part.records);
+        }
+        std::cout << "排序完成，结果按键范围保存为 " << partitions.size() << " 个文件 " << output_file << ".part*，清单 "
+                  << output_file << PARTS_SUFFIX << std::endl;
+        std::cout << "分区输出: 同时归并 " << stats.partition_workers << " 个分区，每个分区最少 " << fewest << " 条、最多 "
+                  << most << " 条记录" << std::endl;
+    } else {
+        std::cout << "排序完成，结果保存为 " << output_file << std::endl;
+    }
+    std::cout << "已排序输入文件: " << stats.presorted_files
+              << "，已有序块: " << stats.presorted_blocks
+              << "，反转块: " << stats.reversed_blocks
+              << "，完整排序块: " << stats.sorted_blocks
+              << "，合并的重复记录: " << stats.collapsed_duplicates << std::endl;
+    if (!options.job_id.empty()) {
+        std::cout << "断点续排: 跳过已处理的输入文件 " << stats.resumed_inputs
+                  << " 个，恢复归并段 " << stats.resumed_runs << " 个" << std::endl;
+    }
+    if (!options.ranges.empty()) {
+        double selectivity = stats.scanned_keys == 0 ? 0.0 : 100.0 * stats.kept_keys / stats.scanned_keys;
+        std::cout << "范围过滤: 读取 " << stats.scanned_keys << " 个键，保留 " << stats.kept_keys
+                  << " 个，选择率 " << selectivity << "%" << std::endl;
+    }
+    if (stats.bucket_engine) {
+        uint64_t data_bytes = stats.kept_keys * sizeof(int64_t);
+        // 每一趟把数据读一遍、写一遍，理想情况是两趟
+        double passes =
+            data_bytes == 0 ? 0.0 : static_cast<double>(stats.io_read_bytes + stats.io_write_bytes) / 2 / data_bytes;
+        std::cout << "分布排序: 排序桶 " << stats.buckets_sorted << " 个，相同键桶 " << stats.uniform_buckets
+                  << " 个，再次拆分 " << stats.bucket_splits << " 次；读 " << stats.io_read_bytes << " 字节，写 "
+                  << stats.io_write_bytes << " 字节，相当于 " << passes << " 趟" << std::endl;
+    }
+    std::cout << "内存预算: " << memory.Limit() << " 字节" << (memory.CgroupLimited() ? "（受 cgroup 限制）" : "")
+              << "，峰值 " << memory.Peak() << " 字节，数据块调整 " << stats.block_resizes
+              << " 次，内存压力下收缩 " << memory.ShrinkEvents() << " 次、恢复 " << memory.GrowEvents() << " 次" << std::endl;
+    if (options.numa) {
+        if (stats.numa_nodes == 0) {
+            std::cout << "NUMA: 只有一个节点或内存预算不足，按单线程处理" << std::endl;
+        } else {
+            size_t sampled = stats.numa_local_pages + stats.numa_remote_pages;
+            double remote = sampled == 0 ? 0.0 : 100.0 * stats.numa_remote_pages / sampled;
+            std::cout << "NUMA: 使用 " << stats.numa_nodes << " 个节点，抽样页面 " << sampled
+                      << " 个，远端页面比例 " << remote << "%" << std::endl;
+        }
+    }
+    PrintDiskReport(elapsed);
     return 0;
 }
@@ -0,0 +1,255 @@
+#ifndef TEXT_PARSER_H
+#define TEXT_PARSER_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 十进制文本输入的解析库，每行一个整数，或者从 CSV 的指定列中取整数。
+// 换行符和分隔符用 SSE2 每次比较 16 个字节查找，整数每次用 SWAR 转换 8 个数字，
+// 解析出的键直接写入调用方的数据块，不经过中间的字符串。
+
+// 在 [p, end) 中查找第一个等于 a 或 b 的字节，找不到时返回 end
+inline const char* FindEither(const char* p, const char* end, char a, char b) {
+#if defined(__SSE2__)
+    const __m128i needle_a = _mm_set1_epi8(a);
+    const __m128i needle_b = _mm_set1_epi8(b);
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, needle_a), _mm_cmpeq_epi8(block, needle_b)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p != end && *p != a && *p != b) {
+        ++p;
+    }
+    return p;
+}
+
+inline const char* FindByte(const char* p, const char* end, char c) {
+    return FindEither(p, end, c, c);
+}
+
+// 8 个字节是否都是 '0' 到 '9'
+inline bool IsEightDigits(uint64_t chunk) {
+    return (((chunk + 0x4646464646464646ULL) | (chunk - 0x3030303030303030ULL)) & 0x8080808080808080ULL) == 0;
+}
+
+// 把按小端序读入的 8 个数字字符转换为整数：先两两合并为 0~99，再合并为 0~9999，最后合并为结果
+inline uint32_t ParseEightDigits(uint64_t chunk) {
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10) + (chunk >> 8);
+    chunk = (((chunk & 0x000000FF000000FFULL) * 0x000F424000000064ULL) +
+             (((chunk >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >> 32;
+    return static_cast<uint32_t>(chunk);
+}
+
+enum class ParseStatus {
+    kOk,
+    kInvalid,  // 没有数字
+    kOverflow  // 超出 int64_t 的范围
+};
+
+// 解析 p 处的带符号十进制整数，p 前进到数字之后
+inline ParseStatus ParseInt64(const char*& p, const char* end, int64_t& value) {
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    const char* digits = p;
+    while (p != end && *p == '0') {
+        ++p;
+    }
+    const char* significant = p;
+
+    // 前 16 个有效数字按 8 个一组转换，不会溢出
+    uint64_t magnitude = 0;
+    while (end - p >= 8 && p - significant <= 8) {
+        uint64_t chunk;
+        std::memcpy(&chunk, p, sizeof(chunk));
+        if (!IsEightDigits(chunk)) {
+            break;
+        }
+        magnitude = magnitude * 100000000 + ParseEightDigits(chunk);
+        p += 8;
+    }
+    while (p != end && static_cast<unsigned char>(*p - '0') < 10) {
+        magnitude = magnitude * 10 + static_cast<uint64_t>(*p - '0');
+        ++p;
+    }
+    if (p == digits) {
+        return ParseStatus::kInvalid;
+    }
+    // 19 位以内不会超出 uint64_t，更长的数字很少见，重新带溢出检查地计算一遍
+    bool overflow = false;
+    if (p - significant > 19) {
+        magnitude = 0;
+        for (const char* q = significant; q != p; ++q) {
+            overflow |= __builtin_mul_overflow(magnitude, 10, &magnitude);
+            overflow |= __builtin_add_overflow(magnitude, static_cast<uint64_t>(*q - '0'), &magnitude);
+        }
+    }
+    if (overflow || magnitude > static_cast<uint64_t>(INT64_MAX) + negative) {
+        return ParseStatus::kOverflow;
+    }
+    value = negative ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+    return ParseStatus::kOk;
+}
+
+// 解析命令行参数：整个字符串必须是 [min, max] 中的十进制整数，否则返回 false 且不修改 value
+inline bool ParseArgument(const std::string& text, int64_t min, int64_t max, int64_t& value) {
+    const char* p = text.data();
+    const char* end = p + text.size();
+    int64_t parsed;
+    if (ParseInt64(p, end, parsed) != ParseStatus::kOk || p != end || parsed < min || parsed > max) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// 从输入流按块读取文本并解析键。每次只处理缓存中完整的行，
+// 末尾不完整的行移到缓存开头，与下一块拼起来；一行比缓存还长时缓存加倍。
+class TextKeyReader {
+public:
+    // 缓存加倍之前调用，参数是扩大期间新旧缓存合计的字节数，返回 false 表示不允许扩大
+    using GrowHook = std::function<bool(size_t)>;
+
+    // column 为 0 时整行是一个整数，否则取以 delimiter 分隔的第 column 列（从 1 开始）
+    TextKeyReader(std::istream& input, const std::string& name, size_t column, char delimiter, size_t chunk_size,
+                  GrowHook can_grow = GrowHook())
+        : input_(input), name_(name), column_(column), delimiter_(delimiter), buffer_(chunk_size),
+          can_grow_(std::move(can_grow)) {}
+
+    // 解析最多 max_count 个键写入 out，返回写入的个数；少于 max_count 表示输入已经读完
+    // 遇到无效的整数或溢出时抛出 std::runtime_error，消息中带有文件名和行号
+    size_t Read(int64_t* out, size_t max_count) {
+        size_t count = 0;
+        while (count < max_count) {
+            if (pos_ == limit_ && !Refill()) {
+                break;
+            }
+            const char* p = buffer_.data() + pos_;
+            const char* limit = buffer_.data() + limit_;
+            while (count < max_count && p != limit) {
+                p = ParseLine(p, limit, out, count);
+            }
+            pos_ = p - buffer_.data();
+        }
+        return count;
+    }
+
+    uint64_t LineNumber() const { return line_; }
+
+private:
+    std::istream& input_;
+    std::string name_;
+    size_t column_;
+    char delimiter_;
+    std::vector<char> buffer_;
+    GrowHook can_grow_;
+    size_t pos_ = 0;   // 下一个未解析的字节
+    size_t limit_ = 0; // 最后一个完整行之后的位置
+    size_t end_ = 0;   // 缓存中有效数据的结尾
+    bool eof_ = false;
+    uint64_t line_ = 0; // 已经解析的行数
+
+    // 把未处理的数据移到缓存开头，读入更多数据，并确定最后一个完整行的结尾
+    bool Refill() {
+        std::memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+        end_ -= pos_;
+        pos_ = 0;
+        limit_ = 0;
+        while (limit_ == 0) {
+            if (eof_) {
+                // 最后一行没有换行符
+                limit_ = end_;
+                return end_ != 0;
+            }
+            if (end_ == buffer_.size()) {
+                if (can_grow_ && !can_grow_(buffer_.size() * 3)) {
+                    ++line_;
+                    Fail("行太长，超出内存预算");
+                }
+                buffer_.resize(buffer_.size() * 2);
+            }
+            input_.read(buffer_.data() + end_, buffer_.size() - end_);
+            size_t got = input_.gcount();
+            eof_ = got < buffer_.size() - end_;
+            // 只需在新读入的部分里从后往前找换行符
+            for (size_t i = end_ + got; i > end_; --i) {
+                if (buffer_[i - 1] == '\n') {
+                    limit_ = i;
+                    break;
+                }
+            }
+            end_ += got;
+        }
+        return true;
+    }
+
+    // 跳过空白，分隔符本身是空白字符（如制表符）时不跳过
+    const char* SkipBlanks(const char* p, const char* end) const {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\r') && *p != delimiter_) {
+            ++p;
+        }
+        return p;
+    }
+
+    // 解析从 p 开始的一行，返回下一行的开头
+    const char* ParseLine(const char* p, const char* limit, int64_t* out, size_t& count) {
+        ++line_;
+        const char* field = SkipBlanks(p, limit);
+        if (field == limit || *field == '\n') {
+            return field == limit ? limit : field + 1; // 空行
+        }
+
+        for (size_t c = 1; c < column_; ++c) {
+            field = FindEither(field, limit, delimiter_, '\n');
+            if (field == limit || *field == '\n') {
+                Fail("缺少第 " + std::to_string(column_) + " 列");
+            }
+            field = SkipBlanks(field + 1, limit);
+        }
+
+        int64_t value = 0;
+        ParseStatus status = ParseInt64(field, limit, value);
+        if (status == ParseStatus::kInvalid) {
+            Fail("无效的整数");
+        } else if (status == ParseStatus::kOverflow) {
+            Fail("整数超出 int64 范围");
+        }
+        out[count++] = value;
+
+        field = SkipBlanks(field, limit);
+        if (field == limit) {
+            return limit;
+        }
+        if (*field == '\n') {
+            return field + 1;
+        }
+        if (column_ == 0 || *field != delimiter_) {
+            Fail("整数后有多余的字符");
+        }
+        // 跳过这一行剩下的列
+        const char* newline = FindByte(field, limit, '\n');
+        return newline == limit ? limit : newline + 1;
+    }
+
+    [[noreturn]] void Fail(const std::string& message) const {
+        throw std::runtime_error(name_ + " 第 " + std::to_string(line_) + " 行: " + message);
+    }
+};
+
+#endif // TEXT_PARSER_H
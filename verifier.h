@@ -0,0 +1,211 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sorted_index.h"
+
+// 排序结果校验库。
+// 用与顺序无关的多重集合哈希（混合后键的和与异或，再加上个数）比较输入和输出是否是同一批键，
+// 可以发现丢失、重复和被替换的值，而不只是比较个数。排序程序在读入输入时顺便计算这个哈希，
+// 写在输出文件旁边后缀为 .sum 的文件里，校验时只需扫描一遍输出。
+
+const char* const SUM_SUFFIX = ".sum";
+
+struct MultisetHash {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t xor_sum = 0;
+
+    void Add(int64_t key) {
+        uint64_t h = MixKey(key);
+        ++count;
+        sum += h;
+        xor_sum ^= h;
+    }
+
+    // 计数模式下一条记录代表 times 个相同的键
+    void Add(int64_t key, uint64_t times) {
+        uint64_t h = MixKey(key);
+        count += times;
+        sum += h * times;
+        xor_sum ^= (times & 1) ? h : 0;
+    }
+
+    void Merge(const MultisetHash& other) {
+        count += other.count;
+        sum += other.sum;
+        xor_sum ^= other.xor_sum;
+    }
+
+    bool operator==(const MultisetHash& other) const {
+        return count == other.count && sum == other.sum && xor_sum == other.xor_sum;
+    }
+    bool operator!=(const MultisetHash& other) const { return !(*this == other); }
+};
+
+// .sum 文件记录输出的格式：聚合方式（none、distinct、count、smallest、largest 或 strings）和记录大小，
+// 输出与输入是同一批键时还记录它们的多重集合哈希。去重和部分排序的输出只记录格式，
+// 校验程序和增量模式据此判断能否按什么格式读取这个输出。分区输出还记录分区数，数据在各个分区文件中
+struct SumInfo {
+    std::string mode;
+    uint32_t record_size = sizeof(int64_t);
+    uint32_t partitions = 0; // 0 表示输出是单个文件
+    bool has_hash = false;
+    MultisetHash hash;
+};
+
+inline bool WriteSumFile(const std::string& path, const SumInfo& info) {
+    std::ofstream output(path, std::ios::trunc);
+    output << "mode " << info.mode << "\n"
+           << "record_size " << info.record_size << "\n";
+    if (info.partitions > 0) {
+        output << "partitions " << info.partitions << "\n";
+    }
+    if (info.has_hash) {
+        output << "count " << info.hash.count << "\n"
+               << "sum " << info.hash.sum << "\n"
+               << "xor " << info.hash.xor_sum << "\n";
+    }
+    return static_cast<bool>(output);
+}
+
+// 格式不完整（包括没有 mode 的旧文件）时返回 false
+inline bool ReadSumFile(const std::string& path, SumInfo& info) {
+    std::ifstream input(path);
+    std::string name;
+    bool has_mode = false;
+    bool has_record_size = false;
+    int hash_fields = 0;
+    while (input >> name) {
+        if (name == "mode") {
+            has_mode = static_cast<bool>(input >> info.mode);
+        } else if (name == "record_size") {
+            has_record_size = static_cast<bool>(input >> info.record_size);
+        } else if (name == "partitions") {
+            if (!(input >> info.partitions)) {
+                return false;
+            }
+        } else if (name == "count") {
+            hash_fields += static_cast<bool>(input >> info.hash.count);
+        } else if (name == "sum") {
+            hash_fields += static_cast<bool>(input >> info.hash.sum);
+        } else if (name == "xor") {
+            hash_fields += static_cast<bool>(input >> info.hash.xor_sum);
+        } else {
+            return false;
+        }
+    }
+    info.has_hash = hash_fields == 3;
+    return has_mode && has_record_size && (hash_fields == 0 || hash_fields == 3);
+}
+
+struct ScanResult {
+    bool ok = false; // 文件能正常打开并映射
+    bool sorted = true;
+    uint64_t first_violation = 0; // 第一个逆序记录的下标
+    MultisetHash hash;
+};
+
+// 用 mmap 并行扫描文件：每个线程处理一段连续的记录，检查有序性并计算多重集合哈希。
+// record_size 为 16 时按计数模式解释记录；strict 要求键严格递增（去重和计数模式的输出）。
+inline ScanResult ScanFile(const std::string& path, uint32_t record_size, bool check_order, bool strict,
+                           unsigned threads = std::thread::hardware_concurrency()) {
+    ScanResult result;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return result;
+    }
+    struct stat st;
+    // 输出文件必须由完整的记录组成；输入文件末尾不足一条记录的字节与排序程序一样忽略
+    if (::fstat(fd, &st) != 0 || (check_order && st.st_size % record_size != 0)) {
+        ::close(fd);
+        return result;
+    }
+    result.ok = true;
+    uint64_t records = st.st_size / record_size;
+    if (records == 0) {
+        ::close(fd);
+        return result;
+    }
+
+    void* mapped = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        result.ok = false;
+        return result;
+    }
+    ::madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+    const char* base = static_cast<const char*>(mapped);
+    size_t stride = record_size / sizeof(int64_t);
+    bool counted = record_size >= 2 * sizeof(int64_t);
+
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>((records + 65535) / 65536)));
+    std::vector<ScanResult> parts(threads);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            uint64_t begin = records * t / threads;
+            uint64_t end = records * (t + 1) / threads;
+            ScanResult& part = parts[t];
+            const int64_t* keys = reinterpret_cast<const int64_t*>(base);
+
+            // 分段检查：段内无分支地统计逆序个数，便于编译器向量化，发现逆序后再定位具体位置
+            const uint64_t chunk = 4096;
+            for (uint64_t i = begin; i < end && check_order && part.sorted; i += chunk) {
+                uint64_t chunk_end = std::min(i + chunk, end);
+                uint64_t breaks = 0;
+                for (uint64_t j = std::max<uint64_t>(i, 1); j < chunk_end; ++j) {
+                    int64_t prev = keys[(j - 1) * stride];
+                    int64_t cur = keys[j * stride];
+                    breaks += strict ? prev >= cur : prev > cur;
+                }
+                if (breaks != 0) {
+                    for (uint64_t j = std::max<uint64_t>(i, 1); j < chunk_end; ++j) {
+                        int64_t prev = keys[(j - 1) * stride];
+                        int64_t cur = keys[j * stride];
+                        if (strict ? prev >= cur : prev > cur) {
+                            part.sorted = false;
+                            part.first_violation = j;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            for (uint64_t i = begin; i < end; ++i) {
+                if (counted) {
+                    uint64_t times;
+                    std::memcpy(&times, base + i * record_size + sizeof(int64_t), sizeof(times));
+                    part.hash.Add(keys[i * stride], times);
+                } else {
+                    part.hash.Add(keys[i]);
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    ::munmap(mapped, st.st_size);
+
+    for (const auto& part : parts) {
+        if (!part.sorted && result.sorted) {
+            result.sorted = false;
+            result.first_violation = part.first_violation;
+        }
+        result.hash.Merge(part.hash);
+    }
+    return result;
+}
+
+#endif // VERIFIER_H
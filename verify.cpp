@@ -0,0 +1,113 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "text_parser.h"
+#include "verifier.h"
+
+// 校验排序结果：检查是否有序，并用多重集合哈希确认输出与输入是同一批键。
+// 排序程序写出的 .sum 文件记录了输出的格式和输入的哈希，校验时与它比较；去重、部分排序、字符串和分区输出
+// 不是与输入相同的单个整数文件，无法这样校验，直接报错。
+// 没有 .sum 文件时只有用 --names 明确给出输入文件列表才校验，此时按普通排序的输出（每条记录一个键）处理。
+//   verify [--output sorted_data.bin] [--names test_files/names.txt] [--strict] [--threads N]
+const char* const USAGE =
+    "用法: verify [--output sorted_data.bin] [--names test_files/names.txt] [--strict] [--threads N]";
+const int64_t MAX_VERIFY_THREADS = 1024;
+
+int main(int argc, char* argv[]) {
+    std::string output_file = "sorted_data.bin";
+    std::string names_path;
+    bool strict = false;
+    unsigned threads = std::thread::hardware_concurrency();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--output" && i + 1 < argc) {
+            output_file = argv[++i];
+        } else if (arg == "--names" && i + 1 < argc) {
+            names_path = argv[++i];
+        } else if (arg == "--strict") {
+            strict = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            int64_t count;
+            if (!ParseArgument(argv[++i], 1, MAX_VERIFY_THREADS, count)) {
+                std::cerr << "线程数必须在 1 到 " << MAX_VERIFY_THREADS << " 之间: " << argv[i] << std::endl;
+                std::cerr << USAGE << std::endl;
+                return 1;
+            }
+            threads = static_cast<unsigned>(count);
+        } else {
+            std::cerr << "无效的参数: " << arg << std::endl;
+            std::cerr << USAGE << std::endl;
+            return 1;
+        }
+    }
+
+    MultisetHash expected;
+    uint32_t record_size = sizeof(int64_t);
+    SumInfo sum;
+    if (ReadSumFile(output_file + SUM_SUFFIX, sum)) {
+        if (sum.partitions > 0) {
+            std::cerr << "无法校验分区输出: " << output_file << " 的数据在 " << sum.partitions << " 个分区文件中" << std::endl;
+            return 1;
+        }
+        if (sum.mode == "strings") {
+            std::cerr << "无法校验 strings 模式的输出: " << output_file << " 是文本行而不是整数记录" << std::endl;
+            return 1;
+        }
+        if (!sum.has_hash) {
+            if (sum.mode == "none" || sum.mode == "count") {
+                std::cerr << "无法校验 " << output_file << ": 排序时没有记录输入的哈希" << std::endl;
+            } else {
+                std::cerr << "无法校验 " << sum.mode << " 模式的输出: " << output_file << " 与输入不是同一批键" << std::endl;
+            }
+            return 1;
+        }
+        expected = sum.hash;
+        record_size = sum.record_size;
+        std::cout << "使用排序时记录的输入哈希: " << output_file << SUM_SUFFIX << std::endl;
+    } else if (names_path.empty()) {
+        std::cerr << "没有 " << output_file << SUM_SUFFIX << "（或格式无法识别），不知道输出的格式；"
+                  << "普通排序的输出可以用 --names 指定输入文件列表来校验" << std::endl;
+        return 1;
+    } else {
+        // 没有 .sum 文件时直接读取所有输入文件计算哈希
+        std::ifstream names(names_path);
+        if (!names.is_open()) {
+            std::cerr << "无法打开 " << names_path << std::endl;
+            return 1;
+        }
+        std::string dir = names_path.substr(0, names_path.find_last_of('/') + 1);
+        std::string file_name;
+        while (std::getline(names, file_name)) {
+            ScanResult input = ScanFile(dir + file_name, sizeof(int64_t), false, false, threads);
+            if (!input.ok) {
+                std::cerr << "无法读取输入文件: " << dir + file_name << std::endl;
+                return 1;
+            }
+            expected.Merge(input.hash);
+        }
+    }
+
+    // 计数模式的输出中每个键只出现一次
+    ScanResult result = ScanFile(output_file, record_size, true, strict || record_size > sizeof(int64_t), threads);
+    if (!result.ok) {
+        std::cerr << "无法读取 " << output_file << "，或文件长度不是记录大小的整数倍" << std::endl;
+        return 1;
+    }
+
+    bool passed = true;
+    if (result.sorted) {
+        std::cout << output_file << " 已按升序排列" << std::endl;
+    } else {
+        std::cout << output_file << " 未按升序排列，第一个逆序位于第 " << result.first_violation << " 条记录" << std::endl;
+        passed = false;
+    }
+
+    std::cout << "输入键数: " << expected.count << "，输出键数: " << result.hash.count << std::endl;
+    if (result.hash == expected) {
+        std::cout << "输出与输入的多重集合哈希一致" << std::endl;
+    } else {
+        std::cout << "输出与输入的多重集合哈希不一致，存在丢失、重复或被修改的值" << std::endl;
+        passed = false;
+    }
+    return passed ? 0 : 1;
+}